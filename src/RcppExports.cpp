@@ -152,6 +152,17 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
+// block_cache
+std::vector<double> block_cache(double size);
+RcppExport SEXP _terra_block_cache(SEXP sizeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type size(sizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(block_cache(size));
+    return rcpp_result_gen;
+END_RCPP
+}
 // percRank
 std::vector<double> percRank(std::vector<double> x, std::vector<double> y, double minc, double maxc, int tail);
 RcppExport SEXP _terra_percRank(SEXP xSEXP, SEXP ySEXP, SEXP mincSEXP, SEXP maxcSEXP, SEXP tailSEXP) {
@@ -184,6 +195,7 @@ static const R_CallMethodDef CallEntries[] = {
     {"_terra_gdal_drivers", (DL_FUNC) &_terra_gdal_drivers, 0},
     {"_terra_set_gdal_warnings", (DL_FUNC) &_terra_set_gdal_warnings, 1},
     {"_terra_gdal_init", (DL_FUNC) &_terra_gdal_init, 1},
+    {"_terra_block_cache", (DL_FUNC) &_terra_block_cache, 1},
     {"_terra_percRank", (DL_FUNC) &_terra_percRank, 5},
     {"_rcpp_module_boot_spat", (DL_FUNC) &_rcpp_module_boot_spat, 0},
     {NULL, NULL, 0}
@@ -6,6 +6,7 @@
 #include "gdal_priv.h"
 #include "gdalio.h"
 #include "ogr_spatialref.h"
+#include "blockcache.h"
 
 
 #if GDAL_VERSION_MAJOR >= 3
@@ -270,6 +271,17 @@ void gdal_init(std::string path) {
 #endif
 }
 
+// the block cache is shared by all SpatRasters, so it is not a SpatOptions property
+// size in MB (ignored if negative). Returns size, hits, misses and MB in use
+// [[Rcpp::export(name = ".blockcache")]]
+std::vector<double> block_cache(double size) {
+	SpatBlockCache& c = blockcache();
+	if (size >= 0) {
+		c.set_size(size * 1048576);
+	}
+	return {c.get_size() / 1048576.0, (double)c.hits, (double)c.misses, c.get_used() / 1048576.0};
+}
+
 // [[Rcpp::export(name = ".precRank")]]
 std::vector<double> percRank(std::vector<double> x, std::vector<double> y, double minc, double maxc, int tail) {
 					
@@ -97,6 +97,36 @@ Rcpp::DataFrame get_geometryDF(SpatVector* v) {
 }
 
 
+Rcpp::List get_columns(SpatVector* v) {
+	SpatGeomColumns g = v->getColumns();
+	Rcpp::List out = Rcpp::List::create(
+			Rcpp::Named("x") = g.x, 
+			Rcpp::Named("y") = g.y, 
+			Rcpp::Named("geom") = std::vector<double>(g.geom.begin(), g.geom.end()),
+			Rcpp::Named("part") = std::vector<double>(g.part.begin(), g.part.end()),
+			Rcpp::Named("ring") = std::vector<double>(g.ring.begin(), g.ring.end())
+	);
+	return out;
+}
+
+bool set_columns(SpatVector* v, std::string type, std::vector<double> x, std::vector<double> y, std::vector<double> geom, std::vector<double> part, std::vector<double> ring) {
+	for (std::vector<double>* d : {&geom, &part, &ring}) {
+		if (std::any_of(d->begin(), d->end(), [](double o) { return !(o >= 0); })) {
+			v->setError("invalid geometry offsets");
+			return false;
+		}
+	}
+	SpatGeomColumns g;
+	g.gtype = v->getGType(type);
+	g.x = x;
+	g.y = y;
+	g.geom.assign(geom.begin(), geom.end());
+	g.part.assign(part.begin(), part.end());
+	g.ring.assign(ring.begin(), ring.end());
+	return v->setColumns(g);
+}
+
+
 RCPP_EXPOSED_CLASS(SpatSRS)
 RCPP_EXPOSED_CLASS(SpatExtent)
 RCPP_EXPOSED_CLASS(SpatMessages)
@@ -244,6 +274,22 @@ RCPP_MODULE(spat){
 	;
 
 
+    class_<SpatVectorReader>("SpatVectorReader")
+		.constructor()
+		.method("open", &SpatVectorReader::open, "open")
+		.method("next", &SpatVectorReader::next, "next")
+		.method("reset", &SpatVectorReader::reset, "reset")
+		.method("close", &SpatVectorReader::close, "close")
+		.method("finished", &SpatVectorReader::finished, "finished")
+		.method("nfeatures", &SpatVectorReader::nfeatures, "nfeatures")
+
+		.method("has_error", &SpatVectorReader::hasError)
+		.method("has_warning", &SpatVectorReader::hasWarning)
+		.method("getWarnings", &SpatVectorReader::getWarnings)
+		.method("getError", &SpatVectorReader::getError)
+	;
+
+
     class_<SpatCategories>("SpatCategories")
 		.constructor()
 		.field_readonly("df", &SpatCategories::d, "d")
@@ -280,6 +326,8 @@ RCPP_MODULE(spat){
 		.method("coordinates", &SpatVector::coordinates)
 		.method("get_geometry", &SpatVector::getGeometry)
 		.method("get_geometryDF", &get_geometryDF)
+		.method("get_columns", &get_columns)
+		.method("set_columns", &set_columns)
 
 		.method("add_column_empty", (void (SpatVector::*)(unsigned dtype, std::string name))( &SpatVector::add_column))
 		.method("add_column_double", (bool (SpatVector::*)(std::vector<double>, std::string name))( &SpatVector::add_column))
@@ -329,6 +377,8 @@ RCPP_MODULE(spat){
 		.method("subset_cols", ( SpatVector (SpatVector::*)(std::vector<int>))( &SpatVector::subset_cols ))
 		.method("subset_rows", ( SpatVector (SpatVector::*)(std::vector<int>))( &SpatVector::subset_rows ))	
 		.method("remove_rows", &SpatVector::remove_rows, "remove_rows")	
+		.method("spatial_order", &SpatVector::spatial_order, "spatial_order")
+		.method("sort_spatial", &SpatVector::sort_spatial, "sort_spatial")
 		.method("type", &SpatVector::type, "type")
 
 		.method("write", &SpatVector::write, "write")
@@ -578,6 +628,7 @@ RCPP_MODULE(spat){
 		.method("as_lines", &SpatRaster::as_lines, "as_lines")
 		.method("as_polygons", &SpatRaster::as_polygons, "as_polygons")
 		.method("polygonize", &SpatRaster::polygonize, "polygonize")
+		.method("polygonize_file", &SpatRaster::polygonize_file, "polygonize_file")
 
 		.method("atan2", &SpatRaster::atan_2, "atan2")
 
@@ -587,6 +638,7 @@ RCPP_MODULE(spat){
 		.method("boundaries", &SpatRaster::edges, "edges")
 		.method("buffer", &SpatRaster::buffer, "buffer")
 		.method("gridDistance", &SpatRaster::gridDistance, "gridDistance")
+		.method("gridCostDistance", &SpatRaster::gridCostDistance, "gridCostDistance")
 		.method("rastDistance", ( SpatRaster (SpatRaster::*)(SpatOptions&) )( &SpatRaster::distance), "rastDistance")
 //		.method("vectDistance", ( SpatRaster (SpatRaster::*)(SpatVector, SpatOptions&) )( &SpatRaster::distance), "vectDistance")
 		.method("vectDistanceRasterize", &SpatRaster::distance_vector_rasterize) 
@@ -639,6 +691,7 @@ RCPP_MODULE(spat){
 		.method("quantile", &SpatRaster::quantile, "quantile")
 		.method("rasterize", &SpatRaster::rasterize, "rasterize")
 		.method("rasterizeLyr", &SpatRaster::rasterizeLyr, "rasterizeLyr")
+		.method("rasterizePolygons", &SpatRaster::rasterizePolygons, "rasterizePolygons")
 		.method("rgb2col", &SpatRaster::rgb2col, "rgb2col")
 		.method("reverse", &SpatRaster::reverse, "reverse")
 		.method("rotate", &SpatRaster::rotate, "rotate")
@@ -649,9 +702,14 @@ RCPP_MODULE(spat){
 		.method("sampleRowColValues", &SpatRaster::sampleRowColValues, "sampleRowCol")
 		.method("sampleRandomRaster", &SpatRaster::sampleRandomRaster, "sampleRandom")
 		.method("sampleRandomValues", &SpatRaster::sampleRandomValues, "sampleValues")
+		.method("sampleStream", &SpatRaster::sampleStream, "sampleStream")
 		.method("scale", &SpatRaster::scale, "scale")
 		.method("shift", &SpatRaster::shift, "shift")
 		.method("terrain", &SpatRaster::terrain, "terrain")
+		.method("hillshade", &SpatRaster::hillshade, "hillshade")
+		.method("fillDepressions", &SpatRaster::fillDepressions, "fillDepressions")
+		.method("flowAccumulation", &SpatRaster::flowAccumulation, "flowAccumulation")
+		.method("watershed", &SpatRaster::watershed, "watershed")
 		.method("summary", &SpatRaster::summary, "summary")
 		.method("summary_numb", &SpatRaster::summary_numb, "summary_numb")
 		.method("transpose", &SpatRaster::transpose, "transpose")
@@ -659,11 +717,13 @@ RCPP_MODULE(spat){
 		.method("trim", &SpatRaster::trim, "trim")
 		.method("unique", &SpatRaster::unique, "unique")
 		.method("sieve", &SpatRaster::sievefilter, "sievefilter")
+		.method("majority", &SpatRaster::majorityfilter, "majorityfilter")
 
 		.method("rectify", &SpatRaster::rectify, "rectify")
 		.method("stretch", &SpatRaster::stretch, "stretch")
 		.method("warp", &SpatRaster::warper, "warper")
 		.method("zonal", &SpatRaster::zonal, "zonal")
+		.method("zonal_vector", &SpatRaster::zonal_vector, "zonal_vector")
 	;
 
     class_<SpatRasterCollection>("SpatRasterCollection")
@@ -0,0 +1,100 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "blockcache.h"
+
+
+SpatBlockCache& blockcache() {
+	static SpatBlockCache cache;
+	return cache;
+}
+
+
+void SpatBlockCache::set_size(size_t bytes) {
+	maxsize = bytes;
+	shrink();
+}
+
+
+void SpatBlockCache::shrink() {
+	while ((used > maxsize) && (!lru.empty())) {
+		entry &e = lru.back();
+		used -= e.second->size() * sizeof(double);
+		index.erase(e.first);
+		lru.pop_back();
+	}
+}
+
+
+std::string SpatBlockCache::key(const std::string &filename, int band, size_t blockcol, size_t blockrow) {
+	return filename + "\t" + std::to_string(band) + "\t" + std::to_string(blockcol) + "\t" + std::to_string(blockrow);
+}
+
+
+SpatBlockCache::block_ptr SpatBlockCache::get(const std::string &k) {
+	auto it = index.find(k);
+	if (it == index.end()) {
+		misses++;
+		return NULL;
+	}
+	hits++;
+	// move to the front (most recently used)
+	lru.splice(lru.begin(), lru, it->second);
+	return it->second->second;
+}
+
+
+SpatBlockCache::block_ptr SpatBlockCache::put(const std::string &k, std::vector<double> &v) {
+	block_ptr b = std::make_shared<const std::vector<double>>(std::move(v));
+	size_t bytes = b->size() * sizeof(double);
+	if (bytes > maxsize) return b;
+	auto it = index.find(k);
+	if (it != index.end()) {
+		used -= it->second->second->size() * sizeof(double);
+		lru.erase(it->second);
+		index.erase(it);
+	}
+	lru.push_front({k, b});
+	index[k] = lru.begin();
+	used += bytes;
+	shrink();
+	return b;
+}
+
+
+void SpatBlockCache::remove(const std::string &filename) {
+	if (lru.empty()) return;
+	std::string f = filename + "\t";
+	for (auto it = lru.begin(); it != lru.end(); ) {
+		if (it->first.compare(0, f.size(), f) == 0) {
+			used -= it->second->size() * sizeof(double);
+			index.erase(it->first);
+			it = lru.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+
+void SpatBlockCache::clear() {
+	lru.clear();
+	index.clear();
+	used = 0;
+	hits = 0;
+	misses = 0;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATBLOCKCACHE_GUARD
+#define SPATBLOCKCACHE_GUARD
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+
+// process-wide least-recently-used cache of blocks of raster cell values read from files. 
+// Blocks are identified by (filename, band, block column, block row). 
+// The cache is disabled if the size is zero (the default)
+class SpatBlockCache {
+	private:
+		typedef std::shared_ptr<const std::vector<double>> block_ptr;
+		typedef std::pair<std::string, block_ptr> entry;
+		std::list<entry> lru;
+		std::unordered_map<std::string, std::list<entry>::iterator> index;
+		size_t maxsize = 0;  // bytes
+		size_t used = 0;
+		void shrink();
+
+	public:
+		size_t hits = 0;
+		size_t misses = 0;
+
+		bool enabled() { return maxsize > 0; }
+		void set_size(size_t bytes);
+		size_t get_size() { return maxsize; }
+		size_t get_used() { return used; }
+
+		std::string key(const std::string &filename, int band, size_t blockcol, size_t blockrow);
+		// NULL if not cached
+		block_ptr get(const std::string &k);
+		block_ptr put(const std::string &k, std::vector<double> &v);
+		// remove all blocks of a file (that is written to or removed)
+		void remove(const std::string &filename);
+		void clear();
+};
+
+SpatBlockCache& blockcache();
+
+#endif
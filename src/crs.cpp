@@ -375,26 +375,32 @@ SpatVector SpatVector::project(std::string crs) {
 	std::vector<unsigned> keeprows;
 
 
+	s.reserve(size());
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = getGeom(i);
 		SpatGeom gg;
 		gg.gtype = g.gtype;
+		gg.reserve(g.size());
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
-			if (poCT->Transform(p.x.size(), &p.x[0], &p.y[0]) ) {
-				SpatPart pp(p.x, p.y);
+			const SpatPart &p = g.getPart(j);
+			std::vector<double> x = p.x;
+			std::vector<double> y = p.y;
+			if (poCT->Transform(x.size(), &x[0], &y[0]) ) {
+				SpatPart pp(std::move(x), std::move(y));
 				if (p.hasHoles()) {
 					for (size_t k=0; k < p.nHoles(); k++) {
-						SpatHole h = p.getHole(k);
-						poCT->Transform(h.x.size(), &h.x[0], &h.y[0]);
-						pp.addHole(h.x, h.y);
+						const SpatHole &h = p.getHole(k);
+						std::vector<double> hx = h.x;
+						std::vector<double> hy = h.y;
+						poCT->Transform(hx.size(), &hx[0], &hy[0]);
+						pp.addHole(std::move(hx), std::move(hy));
 					}
 				}
-				gg.addPart(pp);
+				gg.addPart(std::move(pp));
 			}
 		}
 		keeprows.push_back(i);
-		s.addGeom(gg);
+		s.addGeom(std::move(gg));
 	}
 	s.df = df.subset_rows(keeprows);
 	OCTDestroyCoordinateTransformation(poCT);
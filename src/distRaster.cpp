@@ -18,6 +18,9 @@
 #include "spatRaster.h"
 #include "distance.h"
 #include <limits>
+#include <random>
+#include <queue>
+#include <map>
 #include <cmath>
 #include "geodesic.h"
 #include "recycle.h"
@@ -573,6 +576,321 @@ SpatRaster SpatRaster::gridDistance(SpatOptions &opt) {
 }
 
 
+// accumulated cost-distance with Dijkstra's algorithm, for a block of rows ("tile") at a
+// time. The tiles exchange the distances in the rows along their boundaries ("halo" rows)
+// until these no longer change. Then each tile is computed once more and written.
+
+class CostMoves {
+	public:
+		std::vector<int> dr, dc;
+		// knight moves, and the two cells they pass between (that must be passable)
+		std::vector<bool> knight;
+		std::vector<int> vr1, vc1, vr2, vc2;
+		size_t halo = 1;
+		bool lonlat = false;
+		double xres, yres, m;
+		std::vector<double> ylat; // latitude of each row
+
+		CostMoves(unsigned directions, SpatRaster &x) {
+			dr = {0, 1, 0, -1};
+			dc = {1, 0, -1, 0};
+			if (directions > 4) {
+				dr.insert(dr.end(), {1, 1, -1, -1});
+				dc.insert(dc.end(), {1, -1, -1, 1});
+			}
+			if (directions > 8) {
+				dr.insert(dr.end(), {1, 2, 2, 1, -1, -2, -2, -1});
+				dc.insert(dc.end(), {2, 1, -1, -2, -2, -1, 1, 2});
+				halo = 2;
+			}
+			size_t n = dr.size();
+			knight.resize(n, false);
+			vr1.resize(n, 0); vc1.resize(n, 0); vr2.resize(n, 0); vc2.resize(n, 0);
+			for (size_t k=8; k<n; k++) {
+				knight[k] = true;
+				if (std::abs(dc[k]) == 2) {
+					vr1[k] = 0;     vc1[k] = dc[k] / 2;
+					vr2[k] = dr[k]; vc2[k] = dc[k] / 2;
+				} else {
+					vr1[k] = dr[k] / 2; vc1[k] = 0;
+					vr2[k] = dr[k] / 2; vc2[k] = dc[k];
+				}
+			}
+			xres = x.xres();
+			yres = x.yres();
+			lonlat = x.is_lonlat();
+			m = x.source[0].srs.to_meter();
+			m = (std::isnan(m) || (m == 0)) ? 1 : m;
+			if (lonlat) {
+				ylat.resize(x.nrow());
+				for (size_t i=0; i<ylat.size(); i++) ylat[i] = x.yFromRow((int_64) i);
+			}
+		}
+		size_t size() { return dr.size(); }
+
+		// the length of each move from row "first" to "last"-1 
+		std::vector<std::vector<double>> lengths(long first, long last) {
+			std::vector<std::vector<double>> len(last - first, std::vector<double>(size(), NAN));
+			long nr = ylat.size();
+			for (long r=first; r<last; r++) {
+				for (size_t k=0; k<size(); k++) {
+					if (lonlat) {
+						long r2 = r + dr[k];
+						if ((r < 0) || (r >= nr) || (r2 < 0) || (r2 >= nr)) continue;
+						len[r-first][k] = distance_lonlat(0, ylat[r], dc[k] * xres, ylat[r2]);
+					} else {
+						len[r-first][k] = m * sqrt(pow(dc[k] * xres, 2) + pow(dr[k] * yres, 2));
+					}
+				}
+			}
+			return len;
+		}
+};
+
+
+// Dijkstra for a tile. "cost" has the tile rows and "halo" rows above and below it. 
+// "hd" has the distances for these halo rows (if available). "src" has the source values 
+// for the tile rows. Outputs the distances and back-links (0-based cell number of the
+// cell from which each cell is reached) for the tile rows.
+void cost_tile(const std::vector<double> &cost, const std::vector<double> &src, const std::vector<double> &hd, long row, long nrows, long nr, long nc, CostMoves &mv, std::vector<double> &dist, std::vector<double> &link) {
+
+	long h = mv.halo;
+	long first = row - h;
+	long nt = nrows * nc;
+	dist.assign(nt, std::numeric_limits<double>::infinity());
+	link.assign(nt, NAN);
+	std::vector<std::vector<double>> len = mv.lengths(first, row + nrows + h);
+	const double *cst = &cost[h * nc];
+	size_t nk = mv.size();
+
+	typedef std::pair<double, long> Cell;
+	std::priority_queue<Cell, std::vector<Cell>, std::greater<Cell>> open;
+
+	// a knight move from row r (relative to the tile) and column c cannot pass between 
+	// cells that cannot be crossed
+	auto blocked = [&](long r, long c, size_t k) {
+		if (!mv.knight[k]) return false;
+		double a = cst[(r + mv.vr1[k]) * nc + c + mv.vc1[k]];
+		double b = cst[(r + mv.vr2[k]) * nc + c + mv.vc2[k]];
+		return std::isnan(a) || (a < 0) || std::isnan(b) || (b < 0);
+	};
+
+	for (long i=0; i<nt; i++) {
+		if ((!std::isnan(src[i])) && (!std::isnan(cst[i])) && (cst[i] >= 0)) {
+			dist[i] = 0;
+		}
+	}
+	// from the halo rows into the tile
+	for (long r=-h; r<(nrows+h); r++) {
+		if ((r >= 0) && (r < nrows)) continue;
+		long gr = row + r;
+		if ((gr < 0) || (gr >= nr)) continue;
+		for (long c=0; c<nc; c++) {
+			long hi = (r + h) * nc + c;
+			double d = hd[hi];
+			double ch = cost[hi];
+			if (!std::isfinite(d) || std::isnan(ch) || (ch < 0)) continue;
+			for (size_t k=0; k<nk; k++) {
+				long r2 = r + mv.dr[k];
+				long c2 = c + mv.dc[k];
+				if ((r2 < 0) || (r2 >= nrows) || (c2 < 0) || (c2 >= nc)) continue;
+				long j = r2 * nc + c2;
+				if (std::isnan(cst[j]) || (cst[j] < 0) || blocked(r, c, k)) continue;
+				double z = d + len[r+h][k] * (ch + cst[j]) / 2;
+				if (z < dist[j]) {
+					dist[j] = z;
+					link[j] = gr * nc + c;
+				}
+			}
+		}
+	}
+	for (long i=0; i<nt; i++) {
+		if (std::isfinite(dist[i])) open.push({dist[i], i});
+	}
+
+	while (!open.empty()) {
+		double d = open.top().first;
+		long i = open.top().second;
+		open.pop();
+		if (d > dist[i]) continue;
+		long r = i / nc;
+		long c = i % nc;
+		for (size_t k=0; k<nk; k++) {
+			long r2 = r + mv.dr[k];
+			long c2 = c + mv.dc[k];
+			if ((r2 < 0) || (r2 >= nrows) || (c2 < 0) || (c2 >= nc)) continue;
+			long j = r2 * nc + c2;
+			if (std::isnan(cst[j]) || (cst[j] < 0) || blocked(r, c, k)) continue;
+			double z = d + len[r+h][k] * (cst[i] + cst[j]) / 2;
+			if (z < dist[j]) {
+				dist[j] = z;
+				link[j] = (row + r) * nc + c;
+				open.push({z, j});
+			}
+		}
+	}
+	for (long i=0; i<nt; i++) {
+		if (!std::isfinite(dist[i])) dist[i] = NAN;
+	}
+}
+
+
+SpatRaster SpatRaster::gridCostDistance(SpatRaster cost, unsigned directions, bool links, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1 + links);
+	if (links) {
+		out.setNames({"distance", "from"});
+	} else {
+		out.setNames({"distance"});
+	}
+	if (!((directions == 4) || (directions == 8) || (directions == 16))) {
+		out.setError("directions should be 4, 8 or 16");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("cannot compute distance for a raster with no values");
+		return out;
+	}
+	if (!cost.hasValues()) {
+		out.setError("cost raster has no values");
+		return out;
+	}
+	if (!compare_geom(cost, false, false, opt.get_tolerance())) {
+		out.setError(getError());
+		return(out);
+	}
+	if (nlyr() > 1) {
+		out.addWarning("distance computations are only done for the first input layer");
+	}
+	if (links) {
+		// cell numbers larger than 2^24 cannot be stored exactly as FLT4S
+		if (!opt.datatype_set) {
+			opt.set_datatype("FLT8S");
+		} else if ((opt.get_datatype() != "FLT8S") && (ncell() > 16777216)) {
+			out.addWarning("cell numbers may not be stored exactly with datatype " + opt.get_datatype());
+		}
+	}
+
+	long nr = nrow();
+	long nc = ncol();
+	CostMoves mv(directions, *this);
+	long h = mv.halo;
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!cost.readStart()) {
+		readStop();
+		out.setError(cost.getError());
+		return(out);
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		cost.readStop();
+		return out;
+	}
+	BlockSize bs = out.bs;
+	size_t nt = bs.n;
+
+	// the rows that are in the halo of another tile, and their current distances
+	std::vector<size_t> tile(nr);
+	for (size_t t=0; t<nt; t++) {
+		for (size_t r=bs.row[t]; r<(bs.row[t] + bs.nrows[t]); r++) tile[r] = t;
+	}
+	std::vector<long> slot(nr, -1);
+	size_t nslots = 0;
+	for (long r=0; r<nr; r++) {
+		for (long d=-h; d<=h; d++) {
+			if ((r+d >= 0) && (r+d < nr) && (tile[r+d] != tile[r])) {
+				slot[r] = nslots++;
+				break;
+			}
+		}
+	}
+	std::vector<double> band(nslots * nc, std::numeric_limits<double>::infinity());
+
+	auto halo_dist = [&](long row, long nrows) {
+		std::vector<double> hd((nrows + 2*h) * nc, std::numeric_limits<double>::infinity());
+		for (long r=-h; r<(nrows+h); r++) {
+			if ((r >= 0) && (r < nrows)) continue;
+			long gr = row + r;
+			if ((gr < 0) || (gr >= nr) || (slot[gr] < 0)) continue;
+			std::copy(band.begin() + slot[gr] * nc, band.begin() + (slot[gr]+1) * nc, hd.begin() + (r+h) * nc);
+		}
+		return hd;
+	};
+
+	auto read_tile = [&](size_t t, std::vector<double> &cst, std::vector<double> &src) {
+		long row = bs.row[t];
+		long nrows = bs.nrows[t];
+		long start = std::max(row - h, (long)0);
+		long end = std::min(row + nrows + h, nr);
+		cst = cost.readValues(start, end-start, 0, nc);
+		cst.resize((end-start) * nc);
+		if (start > (row - h)) cst.insert(cst.begin(), (start - row + h) * nc, NAN);
+		cst.resize((nrows + 2*h) * nc, NAN);
+		src = readValues(row, nrows, 0, nc);
+		src.resize(nrows * nc);
+	};
+
+	// exchange the halo rows until they no longer change
+	std::vector<bool> dirty(nt, true);
+	std::vector<double> cst, src, dist, link;
+	bool forward = true;
+	while ((nt > 1) && (std::find(dirty.begin(), dirty.end(), true) != dirty.end())) {
+		for (size_t k=0; k<nt; k++) {
+			size_t t = forward ? k : nt - 1 - k;
+			if (!dirty[t]) continue;
+			dirty[t] = false;
+			long row = bs.row[t];
+			long nrows = bs.nrows[t];
+			read_tile(t, cst, src);
+			cost_tile(cst, src, halo_dist(row, nrows), row, nrows, nr, nc, mv, dist, link);
+			for (long r=0; r<nrows; r++) {
+				long gr = row + r;
+				if (slot[gr] < 0) continue;
+				bool changed = false;
+				double *b = &band[slot[gr] * nc];
+				for (long c=0; c<nc; c++) {
+					double d = dist[r * nc + c];
+					if (d < b[c]) {
+						b[c] = d;
+						changed = true;
+					}
+				}
+				if (changed) {
+					for (long d=-h; d<=h; d++) {
+						if ((gr+d >= 0) && (gr+d < nr) && (tile[gr+d] != t)) dirty[tile[gr+d]] = true;
+					}
+				}
+			}
+		}
+		forward = !forward;
+	}
+
+	for (size_t t=0; t<nt; t++) {
+		long row = bs.row[t];
+		long nrows = bs.nrows[t];
+		read_tile(t, cst, src);
+		cost_tile(cst, src, halo_dist(row, nrows), row, nrows, nr, nc, mv, dist, link);
+		if (links) {
+			for (double &d : link) d += 1;
+			dist.insert(dist.end(), link.begin(), link.end());
+		}
+		if (!out.writeValues(dist, row, nrows, 0, nc)) {
+			readStop();
+			cost.readStop();
+			return out;
+		}
+	}
+	out.writeStop();
+	readStop();
+	cost.readStop();
+	return out;
+}
+
+
 /*
 std::vector<double> do_edge(std::vector<double> &d, size_t nrow, size_t ncol, bool before, bool after, bool classes, bool inner, unsigned dirs) {
 
@@ -1183,9 +1501,8 @@ void SpatVector::fix_lonlat_overflow() {
 	std::string vt = type();
 	if (vt == "points") {
 		for (size_t i=0; i<geoms.size(); i++) {
-			SpatGeom g = geoms[i];
-			for (size_t j=0; j<g.parts.size(); j++) {
-				for (size_t k=0; k<g.parts[j].x.size(); k++) {	
+			for (size_t j=0; j<geoms[i].parts.size(); j++) {
+				for (size_t k=0; k<geoms[i].parts[j].x.size(); k++) {	
 					if (geoms[i].parts[j].x[k] < -180) { geoms[i].parts[j].x[k] += 360; }
 					if (geoms[i].parts[j].x[k] > 180) { geoms[i].parts[j].x[k] -= 360; }
 				}
@@ -1453,8 +1770,56 @@ double area_polygon_lonlat(geod_geodesic &g, const std::vector<double> &lon, con
 }
 
 
+// approximate area of a ring on the WGS84 ellipsoid. The vertices are mapped to 
+// the authalic (equal-area) sphere, and connected by great circles. The error
+// only comes from the shape of the edges, and is negligible for small polygons
+class AuthalicSphere {
+	public:
+		double e, e2, qp, R2;
+		AuthalicSphere() {
+			double a = 6378137;
+			double f = 1 / 298.257223563;
+			e2 = f * (2 - f);
+			e = sqrt(e2);
+			qp = q(1);
+			R2 = a * a * qp / 2;
+		}
+		double q(double sphi) {
+			return (1 - e2) * (sphi / (1 - e2 * sphi * sphi) - log((1 - e * sphi) / (1 + e * sphi)) / (2 * e));
+		}
+		// tan(beta/2) with beta the authalic latitude
+		double tanhalf(double lat) {
+			double sb = q(sin(lat * M_PI / 180)) / qp;
+			sb = std::max(-1.0, std::min(1.0, sb));
+			return sb / (1 + sqrt(1 - sb * sb));
+		}
+		double area(const std::vector<double> &lon, const std::vector<double> &lat) {
+			size_t n = lat.size();
+			if (n < 3) return 0;
+			// sum of the (signed) areas between each edge and the equator
+			double excess = 0;
+			double dlon = 0;
+			double t1 = tanhalf(lat[n-1]);
+			for (size_t i=0; i<n; i++) {
+				double t2 = tanhalf(lat[i]);
+				double d = remainder(lon[i] - lon[(i == 0) ? (n-1) : (i-1)], 360.0);
+				dlon += d;
+				excess += 2 * atan2(tan(d * M_PI / 360) * (t1 + t2), 1 + t1 * t2);
+				t1 = t2;
+			}
+			excess = std::fabs(excess);
+			// the ring goes around a pole
+			if (std::fabs(dlon) > 180) {
+				excess = 2 * M_PI - excess;
+			}
+			// as for the geodesic area, return the smaller of the two regions 
+			excess = std::min(excess, 4 * M_PI - excess);
+			return excess * R2;
+		}
+};
+
 
-double area_polygon_plane(std::vector<double> x, std::vector<double> y) {
+double area_polygon_plane(const std::vector<double> &x, const std::vector<double> &y) {
 // based on http://paulbourke.net/geometry/polygonmesh/source1.c
 	size_t n = x.size();
 	double area = x[n-1] * y[0];
@@ -1481,6 +1846,19 @@ double area_lonlat(geod_geodesic &g, const SpatGeom &geom) {
 }
 
 
+double area_authalic(AuthalicSphere &as, const SpatGeom &geom) {
+	double area = 0;
+	if (geom.gtype != polygons) return area;
+	for (size_t i=0; i<geom.parts.size(); i++) {
+		area += as.area(geom.parts[i].x, geom.parts[i].y);
+		for (size_t j=0; j < geom.parts[i].holes.size(); j++) {
+			area -= as.area(geom.parts[i].holes[j].x, geom.parts[i].holes[j].y);
+		}
+	}
+	return area;
+}
+
+
 double area_plane(const SpatGeom &geom) {
 	double area = 0;
 	if (geom.gtype != polygons) return area;
@@ -1494,7 +1872,7 @@ double area_plane(const SpatGeom &geom) {
 }
 
 
-std::vector<double> SpatVector::area(std::string unit, bool transform, std::vector<double> mask) {
+std::vector<double> SpatVector::area(std::string unit, bool transform, std::vector<double> mask, bool approx) {
 
 	size_t s = size();
 	size_t m = mask.size();
@@ -1516,71 +1894,55 @@ std::vector<double> SpatVector::area(std::string unit, bool transform, std::vect
 		return {NAN};
 	}
 	double adj = unit == "m" ? 1 : unit == "km" ? 1000000 : 10000;
-	
 
+	bool lonlat = false;
 	if (srs.wkt == "") {
 		addWarning("unknown CRS. Results can be wrong");
-		if (domask) {
-			for (size_t i=0; i<s; i++) {
-				if (std::isnan(mask[i])) {
-					ar.push_back(NAN);
-				} else {
-					ar.push_back(area_plane(geoms[i]));
-				}
-			}
-		} else {	
-			for (size_t i=0; i<s; i++) {
-				ar.push_back(area_plane(geoms[i]));
-			}
+	} else if (srs.is_lonlat()) {
+		lonlat = true;
+	} else if (transform) {
+		SpatVector v = project("EPSG:4326");
+		if (v.hasError()) {
+			setError(v.getError());
+			return {NAN};
 		}
+		return v.area(unit, false, mask, approx);
 	} else {
-		if (!srs.is_lonlat()) {
-			if (transform) {
-				SpatVector v = project("EPSG:4326");
-				if (v.hasError()) {
-					setError(v.getError());
-					return {NAN};
-				}
-				return v.area(unit, false, mask);
-				
-			} else {
-				double m = srs.to_meter();
-				adj *= std::isnan(m) ? 1 : m * m;	
-				if (domask) {
-					for (size_t i=0; i<s; i++) {
-						if (std::isnan(mask[i])) {
-							ar.push_back(NAN);
-						} else {
-							ar.push_back(area_plane(geoms[i]));
-						}
-					}
+		double m = srs.to_meter();
+		adj *= std::isnan(m) ? 1 : m * m;	
+	}
+
+	if (lonlat) {
+		if (approx) {
+			AuthalicSphere as;
+			for (size_t i=0; i<s; i++) {
+				if (domask && std::isnan(mask[i])) {
+					ar.push_back(NAN);
 				} else {
-					for (size_t i=0; i<s; i++) {
-						ar.push_back(area_plane(geoms[i]));
-					}
+					ar.push_back(area_authalic(as, geoms[i]));
 				}
 			}
-
 		} else {
-
 			struct geod_geodesic g;
 			double a = 6378137;
 			double f = 1 / 298.257223563;
 			geod_init(&g, a, f);
-			if (domask) {
-				for (size_t i=0; i<s; i++) {
-					if (std::isnan(mask[i])) {
-						ar.push_back(NAN);
-					} else {
-						ar.push_back(area_lonlat(g, geoms[i]));
-					}
-				}
-			} else {
-				for (size_t i=0; i<s; i++) {
+			for (size_t i=0; i<s; i++) {
+				if (domask && std::isnan(mask[i])) {
+					ar.push_back(NAN);
+				} else {
 					ar.push_back(area_lonlat(g, geoms[i]));
 				}
 			}
 		}
+	} else {
+		for (size_t i=0; i<s; i++) {
+			if (domask && std::isnan(mask[i])) {
+				ar.push_back(NAN);
+			} else {
+				ar.push_back(area_plane(geoms[i]));
+			}
+		}
 	}
 	
 	if (adj != 1) {
@@ -1594,14 +1956,51 @@ std::vector<double> SpatVector::area(std::string unit, bool transform, std::vect
 double length_line_lonlat(geod_geodesic &g, const std::vector<double> &lon, const std::vector<double> &lat) {
 	size_t n = lat.size();
 	double length = 0;
+	double s12;
 	for (size_t i=1; i < n; i++) {
-		length += distance_lonlat(lon[i-1], lat[i-1], lon[i], lat[i]);
+		geod_inverse(&g, lat[i-1], lon[i-1], lat[i], lon[i], &s12, NULL, NULL);
+		length += s12;
 	}
 	return (length);
 }
 
 
-double length_line_plane(std::vector<double> x, std::vector<double> y) {
+// Andoyer-Lambert approximation of the geodesic distance on the WGS84 ellipsoid. 
+// The relative error is about 1e-6. Near antipodal points the geodesic is used
+double length_line_lonlat_approx(geod_geodesic &g, const std::vector<double> &lon, const std::vector<double> &lat) {
+	size_t n = lat.size();
+	double length = 0;
+	double a = 6378137;
+	double f = 1 / 298.257223563;
+	double d2r = M_PI / 180;
+	double b1 = atan((1 - f) * tan(lat[0] * d2r));
+	for (size_t i=1; i < n; i++) {
+		double b2 = atan((1 - f) * tan(lat[i] * d2r));
+		double dlon = (lon[i] - lon[i-1]) * d2r;
+		double h = sin((b2 - b1) / 2);
+		double k = sin(dlon / 2);
+		h = h * h + cos(b1) * cos(b2) * k * k;
+		double sigma = 2 * asin(sqrt(std::min(1.0, h)));
+		if (sigma > 3) {
+			double s12;
+			geod_inverse(&g, lat[i-1], lon[i-1], lat[i], lon[i], &s12, NULL, NULL);
+			length += s12;
+		} else if (sigma > 0) {
+			double P = (b1 + b2) / 2;
+			double Q = (b2 - b1) / 2;
+			double sP = sin(P), cP = cos(P), sQ = sin(Q), cQ = cos(Q);
+			double ss = sin(sigma);
+			double X = (sigma - ss) * sP * sP * cQ * cQ / (1 - h);
+			double Y = (sigma + ss) * cP * cP * sQ * sQ / h;
+			length += a * (sigma - f / 2 * (X + Y));
+		}
+		b1 = b2;
+	}
+	return (length);
+}
+
+
+double length_line_plane(const std::vector<double> &x, const std::vector<double> &y) {
 	size_t n = x.size();
 	double length = 0;
 	for (size_t i=1; i<n; i++) {
@@ -1611,13 +2010,17 @@ double length_line_plane(std::vector<double> x, std::vector<double> y) {
 }
 
 
-double length_lonlat(geod_geodesic &g, const SpatGeom &geom) {
+double length_lonlat(geod_geodesic &g, const SpatGeom &geom, bool approx) {
 	double length = 0;
 	if (geom.gtype == points) return length;
 	for (size_t i=0; i<geom.parts.size(); i++) {
-		length += length_line_lonlat(g, geom.parts[i].x, geom.parts[i].y);
-		for (size_t j=0; j<geom.parts[i].holes.size(); j++) {
-			length += length_line_lonlat(g, geom.parts[i].holes[j].x, geom.parts[i].holes[j].y);
+		const SpatPart &p = geom.parts[i];
+		if (p.x.empty()) continue;
+		length += approx ? length_line_lonlat_approx(g, p.x, p.y) : length_line_lonlat(g, p.x, p.y);
+		for (size_t j=0; j<p.holes.size(); j++) {
+			const SpatHole &h = p.holes[j];
+			if (h.x.empty()) continue;
+			length += approx ? length_line_lonlat_approx(g, h.x, h.y) : length_line_lonlat(g, h.x, h.y);
 		}
 	}
 	return length;
@@ -1637,7 +2040,7 @@ double length_plane(const SpatGeom &geom) {
 }
 
 
-std::vector<double> SpatVector::length() {
+std::vector<double> SpatVector::length(bool approx) {
 
 	size_t s = size();
 	std::vector<double> r;
@@ -1652,7 +2055,7 @@ std::vector<double> SpatVector::length() {
 		double f = 1 / 298.257223563;
 		geod_init(&g, a, f);
 		for (size_t i=0; i<s; i++) {
-			r.push_back(length_lonlat(g, geoms[i]));
+			r.push_back(length_lonlat(g, geoms[i], approx));
 		}
 	} else {
 		for (size_t i=0; i<s; i++) {
@@ -1662,9 +2065,61 @@ std::vector<double> SpatVector::length() {
 	return r;
 }
 
+// the area of a cell in each row. For lon/lat this is the exact area of a cell
+// bounded by two meridians and two parallels on the WGS84 ellipsoid
+std::vector<double> row_area(SpatRaster &x, std::string unit) {
+	double adj = unit == "m" ? 1 : unit == "km" ? 1000000 : 10000;
+	size_t nr = x.nrow();
+	if (!x.is_lonlat()) {
+		double m = x.source[0].srs.to_meter();
+		m = std::isnan(m) ? 1 : m;
+		return std::vector<double>(nr, x.xres() * x.yres() * m * m / adj);
+	}
+	std::vector<double> out(nr);
+	AuthalicSphere as;
+	double d2r = M_PI / 180;
+	double ymax = x.getExtent().ymax;
+	double ry = x.yres();
+	double f = as.R2 * x.xres() * d2r / adj;
+	double sb1 = as.q(sin(std::min(90.0, ymax) * d2r)) / as.qp;
+	for (size_t i=0; i<nr; i++) {
+		double lat = std::max(-90.0, std::min(90.0, ymax - (i+1) * ry));
+		double sb2 = as.q(sin(lat * d2r)) / as.qp;
+		out[i] = f * std::fabs(sb1 - sb2);
+		sb1 = sb2;
+	}
+	return out;
+}
+
+
+// the area of each cell in nrows rows, starting at row, computed by transforming the cells to lon/lat
+bool block_area(SpatRaster &x, size_t row, size_t nrows, std::string unit, std::vector<double> &out, SpatOptions &opt) {
+	SpatExtent extent = x.getExtent();
+	double dy = x.yres() / 2;
+	double ymax = x.yFromRow(row) + dy;
+	double ymin = x.yFromRow(row + nrows - 1) - dy;
+	SpatExtent e = {extent.xmin, extent.xmax, ymin, ymax};
+	SpatRaster chunk = x.geometry(1).crop(e, "near", opt);
+	SpatVector p = chunk.as_polygons(false, false, false, false, opt);
+	if (p.hasError()) {
+		x.setError(p.getError());
+		return false;
+	}
+	out = p.area(unit, true, {});
+	if (p.hasError()) {
+		x.setError(p.getError());
+		return false;
+	}
+	return true;
+}
+
+
 SpatRaster SpatRaster::rst_area(bool mask, std::string unit, bool transform, SpatOptions &opt) {
 
-	SpatRaster out = geometry(1);
+	if (mask && !hasValues()) {
+		mask = false;
+	}
+	SpatRaster out = mask ? geometry() : geometry(1);
 	if (out.source[0].srs.wkt == "") {
 		out.setError("empty CRS");
 		return out;
@@ -1676,98 +2131,59 @@ SpatRaster SpatRaster::rst_area(bool mask, std::string unit, bool transform, Spa
 		return out;
 	}
 
-	if (opt.names.size() == 0) {
+	if ((opt.names.size() == 0) && (out.nlyr() == 1)) {
 		opt.names = {"area"};
 	}
-	bool lonlat = is_lonlat();
 
-	SpatOptions mopt(opt);
-	if (mask) {
-		if (!hasValues()) {
-			mask = false;
-		} else {
-			mopt.filenames = opt.filenames;
-			opt = SpatOptions(opt);			
-		}
+	// with lon/lat (or planar without transform) the area only varies by row
+	bool bycell = transform && (!is_lonlat());
+	std::vector<double> ar;
+	if (!bycell) {
+		ar = row_area(out, unit);
 	}
-
-
-
-	if (lonlat) { 
-		bool disagg = false;
-		SpatOptions xopt(opt);
-		SpatExtent extent = getExtent();
-		if ((out.ncol() == 1) && ((extent.xmax - extent.xmin) > 180)) {
-			disagg = true;
-			std::vector<unsigned> fact = {1,2};
-			out = out.disaggregate(fact, xopt);
-		}
-		
-		if (!out.writeStart(opt)) { return out; }
-
-		SpatExtent e = {extent.xmin, extent.xmin+out.xres(), extent.ymin, extent.ymax};
-		SpatRaster onecol = out.crop(e, "near", xopt);
-		SpatVector p = onecol.as_polygons(false, false, false, false, xopt);
-		if (p.hasError()) {
-			out.setError(p.getError());
-			return out;
-		}
-		std::vector<double> a = p.area(unit, true, {});
-		size_t nc = out.ncol();
-		for (size_t i = 0; i < out.bs.n; i++) {
-			std::vector<double> v;
-			for (size_t j=0; j<out.bs.nrows[i]; j++) {
-				size_t r = out.bs.row[i] + j;
-				v.insert(v.end(), nc, a[r]);
+	
+	if (mask && (!readStart())) {
+		out.setError(getError());
+		return out;
+	}
+	if (!out.writeStart(opt)) { 
+		if (mask) readStop();
+		return out; 
+	}
+	size_t nc = ncol();
+	size_t nl = out.nlyr();
+	SpatOptions popt(opt);
+	for (size_t i = 0; i < out.bs.n; i++) {
+		size_t row = out.bs.row[i];
+		size_t nrows = out.bs.nrows[i];
+		std::vector<double> a;
+		if (bycell) {
+			if (!block_area(out, row, nrows, unit, a, popt)) {
+				if (mask) readStop();
+				return out;
 			}
-			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
-		}
-		if (disagg) {
-			out.writeStop();
-			SpatRaster tmp = out.to_memory_copy();
-			std::vector<unsigned> fact = {1,2};
-			opt.overwrite=true;
-			out = tmp.aggregate(fact, "sum", true, opt); 
 		} else {
-			out.writeStop();
+			a.reserve(nrows * nc);
+			for (size_t j=0; j<nrows; j++) {
+				a.insert(a.end(), nc, ar[row+j]);
+			}
 		}
-
-	} else {
-		if (!out.writeStart(opt)) { return out; }
-		if (transform) {
-			SpatExtent extent = getExtent();
-			double dy = yres() / 2;
-			SpatOptions popt(opt);
-			for (size_t i = 0; i < out.bs.n; i++) {
-				double ymax = yFromRow(out.bs.row[i]) + dy;
-				double ymin = yFromRow(out.bs.row[i] + out.bs.nrows[i]-1) - dy;
-				SpatExtent e = {extent.xmin, extent.xmax, ymin, ymax};
-				SpatRaster onechunk = out.crop(e, "near", popt);
-				SpatVector p = onechunk.as_polygons(false, false, false, false, popt);
-				//std::vector<double> cells(onechunk.ncell());
-				//std::iota (cells.begin(), cells.end(), 0);
-				//onechunk.setValues(cells);
-				//SpatVector p = onechunk.as_polygons(false, true, false, false, popt);
-				std::vector<double> v;
-				v = p.area(unit, true, {});
-				if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
+		if (mask) {
+			std::vector<double> v = readValues(row, nrows, 0, nc);
+			size_t off = nrows * nc;
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				double *vl = &v[lyr * off];
+				for (size_t k=0; k<off; k++) {
+					vl[k] = std::isnan(vl[k]) ? NAN : a[k];
+				}
 			}
+			if (!out.writeValues(v, row, nrows, 0, nc)) return out;
 		} else {
-			double u = unit == "m" ? 1 : unit == "km" ? 1000000 : 10000;
-			double m = out.source[0].srs.to_meter();
-			double a = std::isnan(m) ? 1 : m;
-			a *= xres() * yres() / u;
-			for (size_t i = 0; i < out.bs.n; i++) {
-				std::vector<double> v(out.bs.nrows[i]*ncol(), a);
-				if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
-			}
+			if (!out.writeValues(a, row, nrows, 0, nc)) return out;
 		}
-		out.writeStop();
-	} 
-
-	if (mask) {
-		out = out.mask(*this, false, NAN, NAN, mopt);
 	}
+	out.writeStop();
+	if (mask) readStop();
 	return(out);
 }
 
@@ -1785,116 +2201,63 @@ std::vector<double> SpatRaster::sum_area(std::string unit, bool transform, SpatO
 		return {NAN};
 	}
 
-	std::vector<double> out(nlyr(), 0);
-
-	if (transform) { //avoid very large polygon objects
+	bool bycell = transform && (!is_lonlat());
+	if (bycell) { //avoid very large polygon objects
 		opt.set_memfrac(std::max(0.1, opt.get_memfrac()/2));
 	}
-	BlockSize bs = getBlockSize(opt);
-	if (!readStart()) {
-		std::vector<double> err(nlyr(), -1);
-		return(err);
+	std::vector<double> ar;
+	if (!bycell) {
+		ar = row_area(*this, unit);
 	}
+	size_t nc = ncol();
+	BlockSize bs = getBlockSize(opt);
 
-	if (is_lonlat()) {
-		SpatRaster x = geometry(1);
-		SpatExtent extent = x.getExtent();
-		SpatOptions opt;
-		if ((x.ncol() == 1) && ((extent.xmax - extent.xmin) > 180)) {
-			std::vector<unsigned> fact= {1,2};
-			x = x.disaggregate(fact, opt);
-		}
-		size_t nc = x.ncol();
-		SpatExtent e = {extent.xmin, extent.xmin+x.xres(), extent.ymin, extent.ymax};
-		SpatRaster onecol = x.crop(e, "near", opt);
-		SpatVector p = onecol.as_polygons(false, false, false, false, opt);
-		std::vector<double> ar = p.area(unit, true, {});
-		if (!hasValues()) {
-			out.resize(1);
-			for (size_t i=0; i<ar.size(); i++) {
-				out[0] += ar[i] * nc;
-			}
-		} else {
-			for (size_t i=0; i<bs.n; i++) {
-				std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, ncol());
-				size_t blockoff = bs.nrows[i] * nc;
-				for (size_t lyr=0; lyr<nlyr(); lyr++) {
-					size_t lyroff = lyr * blockoff;
-					for (size_t j=0; j<bs.nrows[i]; j++) {
-						size_t row = bs.row[i] + j;
-						size_t offset = lyroff + row * nc;
-						size_t n = offset + nc;
-						for (size_t k=offset; k<n; k++) {
-							if (!std::isnan(v[k])) out[lyr] += ar[row];
-						}
-					}
-				}
-			}
-		}
-	} else if (transform) {
-		SpatRaster x = geometry(1);
-		SpatExtent extent = x.getExtent();
-		double dy = x.yres() / 2;
-		SpatOptions popt(opt);
-		if (!hasValues()) {
-			out.resize(1);
+	if (!hasValues()) {
+		std::vector<double> out(1, 0);
+		if (bycell) {
 			for (size_t i=0; i<bs.n; i++) {
-				double ymax = x.yFromRow(bs.row[i]) + dy;
-				double ymin = x.yFromRow(bs.row[i] + bs.nrows[i]-1) - dy;
-				SpatExtent e = {extent.xmin, extent.xmax, ymin, ymax};
-				SpatRaster onechunk = x.crop(e, "near", popt);
-				SpatVector p = onechunk.as_polygons(false, false, false, false, popt);
-				p = p.project("EPSG:4326");
-				std::vector<double> v = p.area(unit, true, 	{});
-				out[0] += accumulate(v.begin(), v.end(), 0);
+				std::vector<double> a;
+				if (!block_area(*this, bs.row[i], bs.nrows[i], unit, a, opt)) return {NAN};
+				out[0] += std::accumulate(a.begin(), a.end(), 0.0);
 			}
 		} else {
-			for (size_t i=0; i<bs.n; i++) {
-				double ymax = x.yFromRow(bs.row[i]) + dy;
-				double ymin = x.yFromRow(bs.row[i] + bs.nrows[i]-1) - dy;
-				SpatExtent e = {extent.xmin, extent.xmax, ymin, ymax};
-				SpatRaster onechunk = x.crop(e, "near", popt);
-				SpatVector p = onechunk.as_polygons(false, false, false, false, popt);
-				p = p.project("EPSG:4326");
-				std::vector<double> par = p.area(unit, true, {});
-			
-				std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, ncol());
-				unsigned off = bs.nrows[i] * ncol() ;
-				for (size_t lyr=0; lyr<nlyr(); lyr++) {
-					unsigned offset = lyr * off;
-					unsigned n = offset + off;
-					for (size_t j=offset; j<n; j++) {
-						if (!std::isnan(v[j])) {
-							out[lyr] += par[j - offset];
-						}
-					}
-				}
-			}
-		
+			out[0] = std::accumulate(ar.begin(), ar.end(), 0.0) * nc;
 		}
-	} else {
-		double adj = unit == "m" ? 1 : unit == "km" ? 1000000 : 10000;
-		double m = source[0].srs.to_meter();
-		m = std::isnan(m) ? 1 : m;
-		double ar = xres() * yres() * m * m / adj;
-		if (!hasValues()) {
-			out.resize(1);
-			out[0] = ncell() * ar;
-		} else {
-			for (size_t i=0; i<bs.n; i++) {
-				std::vector<double> v = readValues(bs.row[i], bs.nrows[i], 0, ncol());
-				unsigned off = bs.nrows[i] * ncol() ;
-				for (size_t lyr=0; lyr<nlyr(); lyr++) {
-					unsigned offset = lyr * off;
-					unsigned n = offset + off;
-					for (size_t j=offset; j<n; j++) {
-						if (!std::isnan(v[j])) out[lyr]++;
+		return out;
+	}
+
+	size_t nl = nlyr();
+	std::vector<double> out(nl, 0);
+	if (!readStart()) {
+		return std::vector<double>(nl, -1);
+	}
+	for (size_t i=0; i<bs.n; i++) {
+		size_t row = bs.row[i];
+		size_t nrows = bs.nrows[i];
+		std::vector<double> a;
+		if (bycell && (!block_area(*this, row, nrows, unit, a, opt))) {
+			readStop();
+			return {NAN};
+		}
+		std::vector<double> v = readValues(row, nrows, 0, nc);
+		size_t off = nrows * nc;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			const double *vl = &v[lyr * off];
+			if (bycell) {
+				for (size_t k=0; k<off; k++) {
+					if (!std::isnan(vl[k])) out[lyr] += a[k];
+				}
+			} else {
+				// count the cells in a row, and multiply with the area of a cell in that row
+				for (size_t j=0; j<nrows; j++) {
+					const double *vr = vl + j * nc;
+					size_t cnt = 0;
+					for (size_t k=0; k<nc; k++) {
+						cnt += !std::isnan(vr[k]);
 					}
+					out[lyr] += cnt * ar[row+j];
 				}
 			}
-			for (size_t lyr=0; lyr<nlyr(); lyr++) {
-				out[lyr] = out[lyr] * ar;
-			}
 		}
 	}
 	readStop();
@@ -1904,393 +2267,336 @@ std::vector<double> SpatRaster::sum_area(std::string unit, bool transform, SpatO
 
 
 //layer<value-area
-std::vector<std::vector<double>> SpatRaster::area_by_value(SpatOptions &opt) {
-
-	double m = source[0].srs.to_meter();
-	m = std::isnan(m) ? 1 : m;
+std::vector<std::vector<double>> SpatRaster::area_by_value(std::string unit, bool transform, SpatOptions &opt) {
 
-	if (m != 0) {
-		double ar = xres() * yres() * m * m;
-		std::vector<std::vector<double>> f = freq(true, false, 0, opt);
-		for (size_t i=0; i<f.size(); i++) {
-			size_t fs = f[i].size();
-			for (size_t j=fs/2; j<fs; j++) {
-				f[i][j] *= ar;
-			}
-		}
-		return f;
-	} else {
-		// to do
-		// combine freq and area to get area by latitudes
-	
-		std::vector<std::vector<double>> out(nlyr());
+	size_t nl = nlyr();
+	std::vector<std::vector<double>> out(nl);
+	if (source[0].srs.wkt == "") {
+		setError("empty CRS");
+		return out;
+	}
+	std::vector<std::string> f {"m", "km", "ha"};
+	if (std::find(f.begin(), f.end(), unit) == f.end()) {
+		setError("invalid unit");	
+		return out;
+	}
+	if (!hasValues()) {
+		setError("SpatRaster has no values");
 		return out;
 	}
-}
-
-
-
-void do_flowdir(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, double dx, double dy, unsigned seed) {
-
-	size_t n = nrow * ncol;
-	size_t add = val.size();
-	val.resize(add+n, NAN);
-
-	std::vector<double> r = {0, 0, 0, 0, 0, 0, 0, 0};
-	std::vector<double> p = {1, 2, 4, 8, 16, 32, 64, 128}; // pow(2, j)
-	double dxy = sqrt(dx * dx + dy * dy);
 
-	std::default_random_engine generator(seed);
-	std::uniform_int_distribution<> U(0, 1);
+	bool bycell = transform && (!is_lonlat());
+	if (bycell) {
+		opt.set_memfrac(std::max(0.1, opt.get_memfrac()/2));
+	}
+	std::vector<double> ar;
+	if (!bycell) {
+		ar = row_area(*this, unit);
+	}
+	size_t nc = ncol();
+	BlockSize bs = getBlockSize(opt);
 
-	for (size_t row=1; row< (nrow-1); row++) {
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			if (!std::isnan(d[i])) {
-				r[0] = (d[i] - d[i+1]) / dx;
-				r[1] = (d[i] - d[i+1+ncol]) / dxy;
-				r[2] = (d[i] - d[i+ncol]) / dy;
-				r[3] = (d[i] - d[i-1+ncol]) / dxy;
-				r[4] = (d[i] - d[i-1]) / dx;
-				r[5] = (d[i] - d[i-1-ncol]) / dxy;
-				r[6] = (d[i] - d[i-ncol]) / dy;
-				r[7] = (d[i] - d[i+1-ncol]) / dxy;
-				// using the lowest neighbor, even if it is higher than the focal cell.
-				double dmin = r[0];
-				int k = 0;
-				for (size_t j=1; j<8; j++) {
-					if (r[j] > dmin) {
-						dmin = r[j];
-						k = j;
-					} else if (r[j] == dmin) {
-						if (U(generator)) {
-							dmin = r[j];
-							k = j;
-						}
+	// the area of each value is accumulated directly, without a raster of cell areas
+	std::vector<std::map<double, double>> tabs(nl);
+	if (!readStart()) {
+		return out;
+	}
+	for (size_t i=0; i<bs.n; i++) {
+		size_t row = bs.row[i];
+		size_t nrows = bs.nrows[i];
+		std::vector<double> a;
+		if (bycell && (!block_area(*this, row, nrows, unit, a, opt))) {
+			readStop();
+			return out;
+		}
+		std::vector<double> v = readValues(row, nrows, 0, nc);
+		size_t off = nrows * nc;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			const double *vl = &v[lyr * off];
+			std::map<double, double> &tab = tabs[lyr];
+			for (size_t j=0; j<nrows; j++) {
+				const double *vr = vl + j * nc;
+				double rowar = bycell ? 0 : ar[row+j];
+				// runs of the same value are common
+				double prev = NAN;
+				double *acc = NULL;
+				for (size_t k=0; k<nc; k++) {
+					if (std::isnan(vr[k])) continue;
+					if ((acc == NULL) || (vr[k] != prev)) {
+						prev = vr[k];
+						acc = &tab[prev];
 					}
+					*acc += bycell ? a[j * nc + k] : rowar;
 				}
-				val[i+add] = p[k];
 			}
 		}
 	}
-}
-
+	readStop();
 
-void do_TRI(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol) {
-	size_t n = nrow * ncol;
-	size_t add = val.size();
-	val.resize(add+n, NAN);
-	for (size_t row=1; row< (nrow-1); row++) {
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val[i+add] = (fabs(d[i-1-ncol]-d[i]) + fabs(d[i-1]-d[i]) + fabs(d[i-1+ncol]-d[i]) +  fabs(d[i-ncol]-d[i]) + fabs(d[i+ncol]-d[i]) +  fabs(d[i+1-ncol]-d[i]) + fabs(d[i+1]-d[i]) +  fabs(d[i+1+ncol]-d[i])) / 8;
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		size_t n = tabs[lyr].size();
+		out[lyr].reserve(2 * n);
+		for (auto& it : tabs[lyr]) {
+			out[lyr].push_back(it.first);
+		}
+		for (auto& it : tabs[lyr]) {
+			out[lyr].push_back(it.second);
 		}
 	}
+	return out;
 }
 
-void do_TPI(std::vector<double> &val, const std::vector<double> &d, const size_t nrow, const size_t ncol) {
-	size_t n = nrow * ncol;
-	size_t add = val.size();
-	val.resize(add+n, NAN);
-	for (size_t row=1; row< (nrow-1); row++) {
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val[i+add] = d[i] - (d[i-1-ncol] + d[i-1] + d[i-1+ncol] + d[i-ncol]
-			+ d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 8;
-		}
-	}
-/*	
-	if (expand) {
-		for (size_t i=1; i < (ncol-1); i++) {
-			val[i+add] = d[i] - (d[i-1] + d[i-1+ncol] + d[i+ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			size_t j = i+(nrow-1) * ncol;
-			val[j+add] = d[j] - (d[j-1-ncol] + d[j-1] + d[j-ncol] + d[j+1-ncol] + d[j+1]) / 5;
-		}
-		for (size_t row=1; row< (nrow-1); row++) {
-			size_t i = row * ncol;
-			val[i+add] = d[i] - (d[i-ncol] + d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			i += ncol - 1;
-			val[i+add] = d[i] - (d[i-ncol] + d[i] + d[i+ncol] + d[i-ncol]) / 5;
-		}
-		size_t i = 0;
-		val[i+add] = d[i] - (d[i+ncol] + d[i+1] + d[i+1+ncol]) / 3;
-		i = ncol-1;
-		val[i+add] = d[i] - (d[i+ncol] + d[i-1] + d[i-1+ncol]) / 3;
-		i = (nrow-1)*ncol;
-		val[i+add] = d[i] - (d[i-ncol] + d[i+1] + d[i+1-ncol]) / 3;
-		i = (nrow*ncol)-1;
-		val[i+add] = d[i] - (d[i-ncol] + d[i-1] + d[i-1-ncol]) / 3;
-	}
-*/	
-}
 
 
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
 
-void do_roughness(std::vector<double> &val, const std::vector<double> &d, size_t nrow, size_t ncol) {
-	size_t n = nrow * ncol;
-	size_t add = val.size();
-	val.resize(add+n, NAN);
-	int incol = ncol;
-	int a[9] = { -1-incol, -1, -1+incol, -incol, 0, incol, 1-incol, 1, 1+incol };
-	double min, max, v;
-	for (size_t row=1; row< (nrow-1); row++) {
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			min = d[i + a[0]];
-			max = d[i + a[0]];
-			for (size_t j = 1; j < 9; j++) {
-				v = d[i + a[j]]; 
-				if (v > max) {
-					max = v;
-				} else if (v < min) {
-					min = v;
-				}
+
+// flow direction of the center cell of a 3x3 neighbourhood z (stored by column:
+// NW, W, SW, N, center, S, NE, E, SE) as a power of 2, starting with 1 for East 
+// and going clockwise. The lowest neighbor is used, even if it is higher than the focal cell,
+// unless there is no lower neighbour and a neighbour is NA; the flow then goes to that cell 
+// (and ends), as water drains into NA cells in fillDepressions.
+double flowdir_cell(const double *z, double dx, double dy, double dxy, std::default_random_engine &generator) {
+
+	if (std::isnan(z[4])) return NAN;
+	double r[8] = {
+		(z[4] - z[7]) / dx,  // E 
+		(z[4] - z[8]) / dxy, // SE
+		(z[4] - z[5]) / dy,  // S
+		(z[4] - z[2]) / dxy, // SW
+		(z[4] - z[1]) / dx,  // W
+		(z[4] - z[0]) / dxy, // NW
+		(z[4] - z[3]) / dy,  // N
+		(z[4] - z[6]) / dxy  // NE
+	};
+	std::uniform_int_distribution<> U(0, 1);
+	double dmin = r[0];
+	int k = 0;
+	for (size_t j=1; j<8; j++) {
+		if (r[j] > dmin) {
+			dmin = r[j];
+			k = j;
+		} else if (r[j] == dmin) {
+			if (U(generator)) {
+				dmin = r[j];
+				k = j;
 			}
-			val[i+add] = max - min;
 		}
 	}
+	if (!(dmin > 0)) {
+		for (size_t j=0; j<8; j++) {
+			if (std::isnan(r[j])) return (double) (1 << j);
+		}
+	}
+	return (double) (1 << k);
 }
 
 
-#ifndef M_PI
-#define M_PI (3.14159265358979323846)
-#endif
+double dmod(double x, double n) {
+	return(x - n * std::floor(x/n));
+}
 
 
+enum TerrainVar { tv_slope, tv_aspect, tv_TPI, tv_TRI, tv_roughness, tv_flowdir, tv_shade };
 
 
-void to_degrees(std::vector<double>& x, size_t start) { 
-	double adj = 180 / M_PI;
-	for (size_t i=start; i<x.size(); i++) {
-		x[i] *= adj;
-	}
-}
+// the parameters of the terrain kernel that do not change between blocks
+class TerrainParams {
+	public:
+		std::vector<int> vars;
+		unsigned ngb = 8;
+		double dy = 1;
+		bool degrees = false;
+		// flowdir
+		double fdx = 1, fdy = 1;
+		std::default_random_engine generator;
+		// shade: cos and sin of the zenith angle, and the direction (radians), of each light source
+		std::vector<double> cos_zen, sin_zen, direction;
+		bool normalize = false;
 
+		bool has(int v) {
+			return std::find(vars.begin(), vars.end(), v) != vars.end();
+		}
+};
 
-void do_slope(std::vector<double> &val, const std::vector<double> &d, unsigned ngb, unsigned nrow, unsigned ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees) {
+
+// all requested terrain variables for a block of nrow rows, in a single pass over 
+// the 3x3 neighbourhood of each cell. "d" has nrow+2 rows: the block with one row 
+// above and one row below it. If "top" ("bottom") the first (last) row of the block 
+// is the first (last) row of the raster and remains NA. "dx" has the cell width 
+// for each row of the block. The output is appended to val (layer by layer)
+void do_terrain(std::vector<double> &val, const std::vector<double> &d, size_t nrow, size_t ncol, const std::vector<double> &dx, bool top, bool bottom, TerrainParams &p) {
 
 	size_t n = nrow * ncol;
+	size_t nv = p.vars.size();
 	size_t add = val.size();
-	val.resize(add+n, NAN);
+	val.resize(add + nv * n, NAN);
+	if (ncol < 3) return;
+
+	bool slope = p.has(tv_slope);
+	bool aspect = p.has(tv_aspect);
+	bool TPI = p.has(tv_TPI);
+	bool TRI = p.has(tv_TRI);
+	bool rough = p.has(tv_roughness);
+	bool flow = p.has(tv_flowdir);
+	bool shade = p.has(tv_shade);
+	bool grad = slope || aspect || shade;
+	size_t nlight = p.direction.size();
+	double fdxy = sqrt(p.fdx * p.fdx + p.fdy * p.fdy);
+	double adj = p.degrees ? 180 / M_PI : 1;
+	double const twoPI = 2 * M_PI;
+	double const halfPI = M_PI / 2;
 
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distHaversine(-dx, gy[i], dx, gy[i]) / 2 ;
+	double out[7];
+	double z[9];
+	size_t rstart = top ? 1 : 0;
+	size_t rend = bottom ? nrow-1 : nrow;
+	for (size_t r=rstart; r<rend; r++) {
+		const double *a = &d[r * ncol];
+		const double *b = a + ncol;
+		const double *c = b + ncol;
+		double xw = 0, yw = 0;
+		if (grad) {
+			if (p.ngb == 8) {
+				xw = -1 / (8 * dx[r]);
+				yw =  1 / (8 * p.dy);
+			} else {
+				xw = -1 / (2 * dx[r]);
+				yw =  1 / (2 * p.dy);
+			}
 		}
-	} 
-
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
-
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
-			}		
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
+		size_t off = add + r * ncol;
+		for (size_t col=1; col<(ncol-1); col++) {
+			z[0] = a[col-1]; z[1] = b[col-1]; z[2] = c[col-1];
+			z[3] = a[col];   z[4] = b[col];   z[5] = c[col];
+			z[6] = a[col+1]; z[7] = b[col+1]; z[8] = c[col+1];
+
+			if (grad) {
+				double zx, zy;
+				if (p.ngb == 8) {
+					zx = (z[6] + 2 * z[7] + z[8] - z[0] - 2 * z[1] - z[2]) * xw;
+					zy = (z[2] + 2 * z[5] + z[8] - z[0] - 2 * z[3] - z[6]) * yw;
+				} else {
+					zx = (z[7] - z[1]) * xw;
+					zy = (z[5] - z[3]) * yw;
 				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val[i+add] = atan(sqrt( pow(zy, 2) + pow(zx, 2) ));
+				double slp = atan(sqrt(zx * zx + zy * zy));
+				double asp = dmod(halfPI - atan2(zy, zx), twoPI);
+				out[tv_slope] = slp * adj;
+				out[tv_aspect] = asp * adj;
+				if (shade) {
+					// the mean illumination from all light sources
+					double cs = cos(slp);
+					double sn = sin(slp);
+					double h = 0;
+					for (size_t k=0; k<nlight; k++) {
+						double hk = cs * p.cos_zen[k] + sn * p.sin_zen[k] * cos(p.direction[k] - asp);
+						if (p.normalize && (hk < 0)) hk = 0;
+						h += hk;
+					}
+					h /= nlight;
+					out[tv_shade] = p.normalize ? h * 255 : h;
 				}
 			}
-		} else { // ngb == 8
-
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] /= -2 * dx;
-				yw[i] /=  2 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val[i+add] =  atan( sqrt( pow(zy, 2) + pow(zx, 2)  ));
+			if (TPI || TRI) {
+				double s = 0, sa = 0;
+				for (size_t k=0; k<9; k++) {
+					s += z[k];
+					sa += fabs(z[k] - z[4]);
 				}
-			}	
-		}
-	} else {
-	
-		if (geo) {
-
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			
-			for (size_t i=0; i<6; i++) {
-				yw[i] = yw[i] / (8 * dy);
+				out[tv_TPI] = z[4] - (s - z[4]) / 8;
+				out[tv_TRI] = sa / 8;
 			}
-						
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (8 * ddx[row]);
-				}
-
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-					   + d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					   
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val[i+add] = atan(sqrt( pow(zy, 2) + pow(zx, 2)));
+			if (rough) {
+				double mn = z[0];
+				double mx = z[0];
+				for (size_t k=1; k<9; k++) {
+					mn = std::min(mn, z[k]);
+					mx = std::max(mx, z[k]);
 				}
+				bool nan = false;
+				for (size_t k=0; k<9; k++) nan = nan || std::isnan(z[k]);
+				out[tv_roughness] = nan ? NAN : mx - mn;
 			}
-		} else {
-	
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
+			if (flow) {
+				out[tv_flowdir] = flowdir_cell(z, p.fdx, p.fdy, fdxy, p.generator);
 			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val[i+add] = atan(sqrt( pow(zy, 2) + pow(zx, 2) ));
-				}
+			for (size_t j=0; j<nv; j++) {
+				val[off + j * n + col] = out[p.vars[j]];
 			}
-		} 
+		}
 	}
-	if (degrees) {
-		to_degrees(val, add);
-	} 
-}
-
-
-double dmod(double x, double n) {
-	return(x - n * std::floor(x/n));
 }
 
 
+// compute the variables in p for each block of x (single layer), with 
+// one extra row above and below each block
+bool terrain_blocks(SpatRaster &x, SpatRaster &out, TerrainParams &p, SpatOptions &opt) {
 
-void do_aspect(std::vector<double> &val, const std::vector<double> &d, unsigned ngb, unsigned nrow, unsigned ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees) {
+	bool lonlat = x.is_lonlat();
+	p.dy = x.yres();
+	p.fdx = x.xres();
+	p.fdy = x.yres();
+	if (lonlat) {
+		p.dy = distHaversine(0, 0, 0, p.dy);
+		double yhalf = x.yFromRow((size_t) x.nrow()/2);
+		p.fdx = distHaversine(0, yhalf, p.fdx, yhalf);
+		p.fdy = p.dy;
+	}
 
-	size_t n = nrow * ncol;
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distHaversine(-dx, gy[i], dx, gy[i]) / 2 ;
-		}
-	} 
-	double zy, zx; 
-	size_t add = val.size();
-	val.resize(add+n, NAN);
-	
-	//double const pi2 = M_PI / 2;
-	double const twoPI = 2 * M_PI;
-	double const halfPI = M_PI / 2;
+	if (!x.readStart()) {
+		out.setError(x.getError());
+		return false;
+	}
+  	if (!out.writeStart(opt)) {
+		x.readStop();
+		return false;
+	}
 	
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
-		
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
-			}			
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
-				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val[i+add] = dmod( halfPI - zx, twoPI);
-				}
-			}
-		} else {
-		
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] = xw[i] / (-2 * dx);
-				yw[i] = yw[i] / (2 * dy);
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val[i+add] = dmod( halfPI - zx, twoPI);
-				}
-			}
+	size_t nr = x.nrow();
+	size_t nc = x.ncol();
+	size_t nv = p.vars.size();
+	if (nr < 3 || nc < 3) {
+		for (size_t i = 0; i < out.bs.n; i++) {
+			std::vector<double> val(out.bs.nrows[i] * nc * nv, NAN);
+			if (!out.writeValues(val, out.bs.row[i], out.bs.nrows[i], 0, nc)) return false;
 		}
-	} else { //	(ngb == 8) {
-		
-		if (geo) {
-					
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			
-			for (size_t i=0; i<6; i++) {
-				yw[i] /= (8 * dy);
-			}
-				
-			for (size_t row=1; row < (nrow-1); row++) {
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (-8 * ddx[row]);
-				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-		
-					zx = atan2(zy, zx);
-					val[i+add] = dmod( halfPI - zx, twoPI);
-				}
-			}
-					
-		} else {
+		out.writeStop();
+		x.readStop();
+		return true;
+	}
 	
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-						+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					zx = atan2(zy, zx);
-					val[i+add] = dmod( halfPI - zx, twoPI);
-				}
+	for (size_t i = 0; i < out.bs.n; i++) {
+		// read one row above and one row below the block, so that there are no 
+		// missing values at the block boundaries
+		size_t row = out.bs.row[i];
+		size_t nrows = out.bs.nrows[i];
+		bool top = row == 0;
+		bool bottom = (row + nrows) == nr;
+		size_t start = top ? 0 : row - 1;
+		size_t end = bottom ? nr : row + nrows + 1;
+		std::vector<double> d = x.readValues(start, end - start, 0, nc);
+		if (top) d.insert(d.begin(), nc, NAN);
+		if (bottom) d.insert(d.end(), nc, NAN);
+
+		std::vector<double> dx(nrows, x.xres());
+		if (lonlat) {
+			std::vector<int_64> rows(nrows);
+			std::iota(rows.begin(), rows.end(), row);
+			std::vector<double> y = x.yFromRow(rows);
+			for (size_t j=0; j<nrows; j++) {
+				dx[j] = distHaversine(-dx[j], y[j], dx[j], y[j]) / 2;
 			}
 		}
+		std::vector<double> val;
+		do_terrain(val, d, nrows, nc, dx, top, bottom, p);
+		if (!out.writeValues(val, row, nrows, 0, nc)) return false;
 	}
-
-	if (degrees) {
-		to_degrees(val, add);
-	}
+	out.writeStop();
+	x.readStop();
+	return true;
 }
 
 
@@ -2308,81 +2614,61 @@ SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, b
 		return out;
 	}
 
-	bool aspslope = false;
-	std::vector<std::string> f {"TPI", "TRI", "aspect", "flowdir", "slope", "roughness"};
+	TerrainParams p;
+	std::vector<std::string> f {"slope", "aspect", "TPI", "TRI", "roughness", "flowdir"};
 	for (size_t i=0; i<v.size(); i++) {
-		if (std::find(f.begin(), f.end(), v[i]) == f.end()) {
+		size_t k = std::find(f.begin(), f.end(), v[i]) - f.begin();
+		if (k == f.size()) {
 			out.setError("unknown terrain variable: " + v[i]);
 			return(out);
 		}
-		if (v[i] == "slope" || v[i] == "aspect") {
-			aspslope=true;
-		} 
+		p.vars.push_back(k);
 	}
 	
 	if ((neighbors != 4) && (neighbors != 8)) {
 		out.setError("neighbors should be 4 or 8");
 		return out;	
 	}
-	bool lonlat = is_lonlat();
-	double yr = yres();
+	p.ngb = neighbors;
+	p.degrees = degrees;
+	p.generator.seed(seed);
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-  	if (!out.writeStart(opt)) {
-		readStop();
+	terrain_blocks(*this, out, p, opt);
+	return out; 
+}
+
+
+SpatRaster SpatRaster::hillshade(std::vector<double> angle, std::vector<double> direction, unsigned neighbors, bool normalize, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"hillshade"});
+
+	if (nlyr() > 1) {
+		out.setError("hillshade needs a single layer object");
 		return out;
 	}
-	
-	if (nrow() < 3 || ncol() < 3) {
-		for (size_t i = 0; i < out.bs.n; i++) {
-			std::vector<double> val(out.bs.nrows[i] * ncol(), NAN);
-			if (!out.writeValues(val, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
-		}
-		return out;
+	if ((neighbors != 4) && (neighbors != 8)) {
+		out.setError("neighbors should be 4 or 8");
+		return out;	
 	}
-	
-	
-	std::vector<double> y;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> d = readValues(out.bs.row[i], out.bs.nrows[i], 0, ncol());
-		if (lonlat && aspslope) {
-			std::vector<int_64> rows(out.bs.nrows[i]);
-			std::iota(rows.begin(), rows.end(), out.bs.row[i]);
-			y = yFromRow(rows);
-			yr = distHaversine(0, 0, 0, yr);
-		}
-		std::vector<double> val;
-		for (size_t j =0; j<v.size(); j++) {
-			if (v[j] == "slope") {
-				do_slope(val, d, neighbors, out.bs.nrows[i], ncol(), xres(), yr, lonlat, y, degrees);
-			} else if (v[j] == "aspect") {
-				do_aspect(val, d, neighbors, out.bs.nrows[i], ncol(), xres(), yr, lonlat, y, degrees);
-			} else if (v[j] == "flowdir") {
-				double dx = xres();
-				double dy = yres();
-				if (lonlat) {
-					double yhalf = yFromRow((size_t) nrow()/2);
-					dx = distHaversine(0, yhalf, dx, yhalf);
-					dy = distHaversine(0, 0, 0, dy);
-				}
-				do_flowdir(val, d, out.bs.nrows[i], ncol(), dx, dy, seed);
-			} else if (v[j] == "roughness") {
-				do_roughness(val, d, out.bs.nrows[i], ncol());
-			} else if (v[j] == "TPI") {
-				do_TPI(val, d, out.bs.nrows[i], ncol());
-			} else if (v[j] == "TRI") {
-				do_TRI(val, d, out.bs.nrows[i], ncol());
-			} else {
-				out.setError("?"); return out;
-			}
-		}
-		if (!out.writeValues(val, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;
+	if (angle.empty() || direction.empty()) {
+		out.setError("angle and direction cannot be empty");
+		return out;	
 	}
-	out.writeStop();
-	readStop();
+	recycle(angle, direction);
+
+	TerrainParams p;
+	p.vars = {tv_shade};
+	p.ngb = neighbors;
+	p.normalize = normalize;
+	double torad = M_PI / 180;
+	for (size_t i=0; i<angle.size(); i++) {
+		double zenith = (90 - angle[i]) * torad;
+		p.cos_zen.push_back(cos(zenith));
+		p.sin_zen.push_back(sin(zenith));
+		p.direction.push_back(direction[i] * torad);
+	}
+
+	terrain_blocks(*this, out, p, opt);
 	return out; 
 }
-
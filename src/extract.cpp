@@ -16,6 +16,7 @@
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 
 #include <functional>
+#include <numeric>
 
 #include "spatRasterMultiple.h"
 #include "distance.h"
@@ -340,9 +341,9 @@ std::vector<double> SpatRaster::line_cells(SpatGeom& g) {
 
 	unsigned np = g.size();
 	for (size_t prt=0; prt<np; prt++) {
-        SpatPart p = g.getPart(prt);
-        double miny = vmin(p.y, true);
-        double maxy = vmax(p.y, true);
+        const SpatPart &p = g.getPart(prt);
+        double miny = p.extent.ymin;
+        double maxy = p.extent.ymax;
 
         double minrow = rowFromY(miny);
         double maxrow = rowFromY(maxy);
@@ -374,70 +375,327 @@ std::vector<double> SpatRaster::line_cells(SpatGeom& g) {
 
 
 
-std::vector<double> SpatRaster::polygon_cells(SpatGeom& g) {
+void ring_edges(const std::vector<double> &x, const std::vector<double> &y, bool hole, std::vector<ScanEdge> &edges) {
+	size_t n = x.size();
+	if (n < 3) return;
+	double a = 0;
+	for (size_t i=0, j=n-1; i<n; j=i++) {
+		a += x[j] * y[i] - x[i] * y[j];
+	}
+	double sign = a < 0 ? -1 : 1;
+	if (hole) sign = -sign;
+	for (size_t i=0, j=n-1; i<n; j=i++) {
+		if (y[i] == y[j]) continue; // horizontal edges do not matter
+		ScanEdge e;
+		e.x1 = x[j];
+		e.y1 = y[j];
+		e.x2 = x[i];
+		e.y2 = y[i];
+		e.ymin = std::min(y[i], y[j]);
+		e.ymax = std::max(y[i], y[j]);
+		e.sign = sign;
+		edges.push_back(e);
+	}
+}
 
-// does not deal with holes yet.
 
-	unsigned nrows = nrow();
-	unsigned ncols = ncol();
-	SpatExtent extent = getExtent();
+void part_edges(const SpatPart &p, std::vector<ScanEdge> &edges) {
+	edges.resize(0);
+	ring_edges(p.x, p.y, false, edges);
+	for (size_t i=0; i<p.holes.size(); i++) {
+		ring_edges(p.holes[i].x, p.holes[i].y, true, edges);
+	}
+	// top to bottom
+	std::sort(edges.begin(), edges.end(), [](const ScanEdge &a, const ScanEdge &b) { return a.ymax > b.ymax; });
+}
+
+
+// the sorted edges of each part of a geometry
+void geom_edges(const SpatGeom &g, std::vector<std::vector<ScanEdge>> &edges) {
+	size_t np = g.parts.size();
+	edges.resize(np);
+	for (size_t i=0; i<np; i++) {
+		part_edges(g.parts[i], edges[i]);
+	}
+}
 
+
+// integral of min(max(t, xl), xr) for t in [a, b]
+inline double clamp_integral(double a, double b, const double &xl, const double &xr) {
+	if (a > b) std::swap(a, b);
+	double s = 0;
+	if (a < xl) {
+		s += xl * (std::min(b, xl) - a);
+		a = xl;
+	}
+	if (b > xr) {
+		s += xr * (b - std::max(a, xr));
+		b = xr;
+	}
+	if (b > a) {
+		s += (b * b - a * a) / 2;
+	}
+	return s;
+}
+
+
+// integral of (min(max(x, xl), xr) - xl) * cos(y) dy along the segment (xa, ya) - (xb, yb)
+// with y in degrees (but integrated in radians); for the area of lon/lat cells
+double clamp_integral_lonlat(const double &xa, const double &ya, const double &xb, const double &yb, const double &xl, const double &xr) {
+	double d2r = M_PI / 180;
+	double pa = ya * d2r;
+	double pb = yb * d2r;
+	if (xa == xb) {
+		return (std::min(std::max(xa, xl), xr) - xl) * (std::sin(pb) - std::sin(pa));
+	}
+	// x = q + k * p   (p in radians)
+	double k = (xb - xa) / (pb - pa);
+	double q = xa - k * pa;
+	std::vector<double> brks = {pa, pb};
+	double pl = (xl - q) / k;
+	double pr = (xr - q) / k;
+	double pmin = std::min(pa, pb);
+	double pmax = std::max(pa, pb);
+	if ((pl > pmin) && (pl < pmax)) brks.push_back(pl);
+	if ((pr > pmin) && (pr < pmax)) brks.push_back(pr);
+	std::sort(brks.begin(), brks.end());
+	double s = 0;
+	for (size_t i=1; i<brks.size(); i++) {
+		double p1 = brks[i-1];
+		double p2 = brks[i];
+		double x = q + k * (p1 + p2) / 2;
+		if (x <= xl) {
+			continue;
+		} else if (x >= xr) {
+			s += (xr - xl) * (std::sin(p2) - std::sin(p1));
+		} else {
+			s += (q - xl) * (std::sin(p2) - std::sin(p1)) + k * (p2 * std::sin(p2) + std::cos(p2) - p1 * std::sin(p1) - std::cos(p1));
+		}
+	}
+	return pa < pb ? s : -s;
+}
+
+
+// cells with their center inside polygon g (holes and multiple parts are 
+// handled with an active edge table, and only the rows of each part are visited)
+std::vector<double> SpatRaster::polygon_cells(SpatGeom& g, size_t firstrow, size_t lastrow) {
+	std::vector<std::vector<ScanEdge>> edges;
+	return polygon_cells(g, edges, firstrow, lastrow);
+}
+
+
+// edges has the sorted edges of each part of g. They are computed here if they are 
+// not there yet, such that they can be reused when other rows of g are processed
+std::vector<double> SpatRaster::polygon_cells(SpatGeom& g, std::vector<std::vector<ScanEdge>> &edges, size_t firstrow, size_t lastrow) {
+
+	std::vector<double> out;
+	size_t nrows = nrow();
+	size_t ncols = ncol();
+	SpatExtent extent = getExtent();
 	double xmin = extent.xmin;
 	double ymax = extent.ymax;
 	double rx = xres();
 	double ry = yres();
-	std::vector<double> out;
 
-	unsigned np = g.size();
+	if (edges.size() != g.size()) {
+		geom_edges(g, edges);
+	}
+	std::vector<size_t> active;
+	std::vector<double> nodes;
+	size_t np = g.size();
 	for (size_t prt=0; prt<np; prt++) {
+		const SpatPart &p = g.parts[prt];
+		if ((p.extent.ymax < extent.ymin) || (p.extent.ymin > ymax) || (p.extent.xmax < xmin) || (p.extent.xmin > extent.xmax)) {
+			continue;
+		}
+		// rows with their center in the y-range of the part
+		double r1 = std::ceil((ymax - p.extent.ymax) / ry - 0.5);
+		double r2 = std::ceil((ymax - p.extent.ymin) / ry - 0.5) - 1;
+		size_t startrow = r1 < 0 ? 0 : r1;
+		if (r2 < 0) continue;
+		size_t endrow = r2 >= nrows ? (nrows-1) : r2;
+		startrow = std::max(startrow, firstrow);
+		endrow = std::min(endrow, lastrow);
+		if (startrow > endrow) continue;
+
+		const std::vector<ScanEdge> &pe = edges[prt];
+		active.resize(0);
+		size_t next = 0;
+		for (size_t row=startrow; row<=endrow; row++) {
+			double y = ymax - (row+0.5) * ry;
+			while ((next < pe.size()) && (pe[next].ymax >= y)) {
+				active.push_back(next);
+				next++;
+			}
+			nodes.resize(0);
+			size_t k = 0;
+			for (size_t i=0; i<active.size(); i++) {
+				const ScanEdge &e = pe[active[i]];
+				if (e.ymin >= y) continue; // done with this edge
+				active[k] = active[i];
+				k++;
+				nodes.push_back(e.x1 + (y - e.y1) * (e.x2 - e.x1) / (e.y2 - e.y1));
+			}
+			active.resize(k);
+			std::sort(nodes.begin(), nodes.end());
+			double rowcell = ncols * row;
+			for (size_t i=1; i < nodes.size(); i+=2) {
+				// first and last column with the center in [nodes[i-1], nodes[i]) 
+				double c1 = std::ceil((nodes[i-1] - xmin) / rx - 0.5);
+				double c2 = std::ceil((nodes[i] - xmin) / rx - 0.5) - 1;
+				c1 = c1 < 0 ? 0 : c1;
+				c2 = c2 >= ncols ? (ncols-1) : c2;
+				for (double col = c1; col <= c2; col++) {
+					out.push_back(rowcell + col);
+				}
+			}
+		}
+	}
+	if (np > 1) {
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+	return(out);
+}
 
-        SpatPart p = g.getPart(prt);
-        double miny = vmin(p.y, true);
-        double maxy = vmax(p.y, true);
-        double minrow = rowFromY(miny);
-        double maxrow = rowFromY(maxy);
-        if (minrow > nrows || maxrow < 0) {
-            return(out);
-        }
-        size_t startrow = minrow < 0 ? 0 : minrow;
-        size_t endrow = maxrow >= nrows ? (nrows-1) : maxrow;
-        unsigned n = p.x.size();
-        out.reserve(5*(startrow-endrow+1));
 
-        std::vector<unsigned> nCol(n);
-        for (size_t row=0; row<nrows; row++) {
-            double y = ymax - (row+0.5) * ry;
-            // find nodes.
-            unsigned nodes = 0;
-            size_t j = n-1;
-            for (size_t i=0; i<n; i++) {
-                if (((p.y[i] < y) && (p.y[j] >= y)) || ((p.y[j] < y) && (p.y[i] >= y))) {
-                //	nCol[nodes++]=(int)  (((pX[i] - xmin + (y-pY[i])/(pY[j]-pY[i]) * (pX[j]-pX[i])) + 0.5 * rx ) / rx);
-                    double nds = ((p.x[i] - xmin + (y-p.y[i])/(p.y[j]-p.y[i]) * (p.x[j]-p.x[i])) + 0.5 * rx ) / rx;
-                    nds = nds < 0 ? 0 : nds;
-                    nds = nds > ncols ? ncols : nds;
-                    nCol[nodes] = (unsigned) nds;
-                    nodes++;
-                }
-                j = i;
-            }
+// all cells that overlap with polygon g, and the fraction of each cell that is covered.
+// The covered area of a cell [xl, xr] x [yl, yh] is the integral, along the edges, of 
+// (min(max(x, xl), xr) - xl) dy for the part of the edge that is in [yl, yh] (Green's theorem)
+// For lon/lat the integrand is multiplied with cos(y) to get the area on the sphere
+void SpatRaster::polygon_cells_exact(SpatGeom& g, std::vector<double> &cells, std::vector<double> &weights, size_t firstrow, size_t lastrow) {
+	std::vector<std::vector<ScanEdge>> edges;
+	polygon_cells_exact(g, edges, cells, weights, firstrow, lastrow);
+}
 
-            // now remove the holes?
 
-            std::sort(nCol.begin(), nCol.begin()+nodes);
-            unsigned rowcell = ncols * row;
+void SpatRaster::polygon_cells_exact(SpatGeom& g, std::vector<std::vector<ScanEdge>> &edges, std::vector<double> &cells, std::vector<double> &weights, size_t firstrow, size_t lastrow) {
 
-            // fill  cells between node pairs.
-            for (size_t i=0; i < nodes; i+=2) {
-                if (nCol[i+1] > 0 && nCol[i] < ncols) { // surely should be >= 0?
-                    for (size_t col = nCol[i]; col < nCol[i+1]; col++) {
-                        out.push_back(col + rowcell);
-                    }
-                }
-            }
-        }
+	cells.resize(0);
+	weights.resize(0);
+	size_t nrows = nrow();
+	size_t ncols = ncol();
+	SpatExtent extent = getExtent();
+	double xmin = extent.xmin;
+	double ymax = extent.ymax;
+	double rx = xres();
+	double ry = yres();
+	double cellarea = rx * ry;
+	double tolerance = 1e-9;
+	bool lonlat = is_lonlat();
+	double d2r = M_PI / 180;
+
+	if (edges.size() != g.size()) {
+		geom_edges(g, edges);
+	}
+	std::vector<size_t> active;
+	std::vector<double> area, diff;
+	size_t np = g.size();
+	for (size_t prt=0; prt<np; prt++) {
+		const SpatPart &p = g.parts[prt];
+		if ((p.extent.ymax <= extent.ymin) || (p.extent.ymin >= ymax) || (p.extent.xmax <= xmin) || (p.extent.xmin >= extent.xmax)) {
+			continue;
+		}
+		double r1 = std::floor((ymax - p.extent.ymax) / ry);
+		double r2 = std::ceil((ymax - p.extent.ymin) / ry) - 1;
+		double c1 = std::floor((p.extent.xmin - xmin) / rx);
+		double c2 = std::ceil((p.extent.xmax - xmin) / rx) - 1;
+		size_t startrow = r1 < 0 ? 0 : r1;
+		size_t endrow = r2 >= nrows ? (nrows-1) : r2;
+		startrow = std::max(startrow, firstrow);
+		endrow = std::min(endrow, lastrow);
+		if (startrow > endrow) continue;
+		size_t startcol = c1 < 0 ? 0 : c1;
+		size_t endcol = c2 >= ncols ? (ncols-1) : c2;
+		size_t span = endcol - startcol + 1;
+
+		const std::vector<ScanEdge> &pe = edges[prt];
+		active.resize(0);
+		size_t next = 0;
+		for (size_t row=startrow; row<=endrow; row++) {
+			double yh = ymax - row * ry;
+			double yl = yh - ry;
+			if (lonlat) {
+				cellarea = rx * (std::sin(yh * d2r) - std::sin(yl * d2r));
+			}
+			while ((next < pe.size()) && (pe[next].ymax > yl)) {
+				active.push_back(next);
+				next++;
+			}
+			// the full-width contributions of the columns left of an edge are 
+			// accumulated in a difference vector
+			area.resize(0);
+			area.resize(span, 0);
+			diff.resize(0);
+			diff.resize(span + 1, 0);
+			size_t k = 0;
+			for (size_t i=0; i<active.size(); i++) {
+				const ScanEdge &e = pe[active[i]];
+				if (e.ymin >= yh) continue; // done with this edge
+				active[k] = active[i];
+				k++;
+				// the part of the edge that is in this row
+				double dxdy = (e.x2 - e.x1) / (e.y2 - e.y1);
+				double ya = std::min(std::max(e.y1, yl), yh);
+				double yb = std::min(std::max(e.y2, yl), yh);
+				if (ya == yb) continue;
+				double dy = lonlat ? (std::sin(yb * d2r) - std::sin(ya * d2r)) : (yb - ya);
+				dy *= e.sign;
+				double xa = e.x1 + (ya - e.y1) * dxdy;
+				double xb = e.x1 + (yb - e.y1) * dxdy;
+				double ec1 = std::floor((std::min(xa, xb) - xmin) / rx);
+				double ec2 = std::floor((std::max(xa, xb) - xmin) / rx);
+				if (ec1 > startcol) {
+					diff[0] += rx * dy;
+					size_t c = ec1 > endcol ? span : ec1 - startcol;
+					diff[c] -= rx * dy;
+				}
+				if ((ec2 < startcol) || (ec1 > endcol)) continue;
+				size_t a = ec1 < startcol ? startcol : ec1;
+				size_t b = ec2 > endcol ? endcol : ec2;
+				for (size_t col=a; col<=b; col++) {
+					double xl = xmin + col * rx;
+					double xr = xl + rx;
+					if (lonlat) {
+						area[col - startcol] += e.sign * clamp_integral_lonlat(xa, ya, xb, yb, xl, xr);
+					} else {
+						double m = (xa == xb) ? std::min(std::max(xa, xl), xr) : clamp_integral(xa, xb, xl, xr) / std::abs(xb - xa);
+						area[col - startcol] += (m - xl) * dy;
+					}
+				}
+			}
+			active.resize(k);
+			double rowcell = ncols * row;
+			double cum = 0;
+			for (size_t i=0; i<span; i++) {
+				cum += diff[i];
+				double w = (area[i] + cum) / cellarea;
+				if (w > tolerance) {
+					cells.push_back(rowcell + startcol + i);
+					weights.push_back(std::min(w, 1.0));
+				}
+			}
+		}
+	}
+	if (np > 1) {
+		// combine the parts
+		std::vector<size_t> ord(cells.size());
+		std::iota(ord.begin(), ord.end(), 0);
+		std::sort(ord.begin(), ord.end(), [&cells](size_t a, size_t b) { return cells[a] < cells[b]; });
+		std::vector<double> c, w;
+		c.reserve(cells.size());
+		w.reserve(cells.size());
+		for (size_t i=0; i<ord.size(); i++) {
+			if ((c.size() > 0) && (c.back() == cells[ord[i]])) {
+				w.back() = std::min(w.back() + weights[ord[i]], 1.0);
+			} else {
+				c.push_back(cells[ord[i]]);
+				w.push_back(weights[ord[i]]);
+			}
+		}
+		cells = c;
+		weights = w;
 	}
-	return(out);
 }
 
 
@@ -614,14 +872,16 @@ std::vector<std::vector<std::vector<double>>> SpatRaster::extractVector(SpatVect
 	    SpatRaster r = geometry(1);
 	    //SpatOptions opt;
 		//std::vector<double> feats(1, 1) ;		
-        for (size_t i=0; i<ng; i++) {
-            SpatGeom g = v.getGeom(i);
+		// visit the geometries along a Hilbert curve such that 
+		// consecutive geometries mostly read the same blocks
+		std::vector<unsigned> ord = v.spatial_order("hilbert");
+        for (size_t k=0; k<ng; k++) {
+			size_t i = ord[k];
+            const SpatGeom &g = v.getGeom(i);
             SpatVector p(g);
 			p.srs = v.srs;
 			std::vector<double> cell, wgt;
-			if (weights) {
-				rasterizeCellsWeights(cell, wgt, p);
-			} else if (exact) {
+			if (weights || exact) {
 				rasterizeCellsExact(cell, wgt, p);
 			} else {
 				cell = rasterizeCells(p, touches);
@@ -733,14 +993,16 @@ std::vector<double> SpatRaster::extractVectorFlat(SpatVector v, bool touches, st
 	    SpatRaster r = geometry(1);
 	    //SpatOptions opt;
 		//std::vector<double> feats(1, 1) ;		
-        for (size_t i=0; i<ng; i++) {
-            SpatGeom g = v.getGeom(i);
+		// visit the geometries along a Hilbert curve such that 
+		// consecutive geometries mostly read the same blocks
+		std::vector<unsigned> ord = v.spatial_order("hilbert");
+        for (size_t k=0; k<ng; k++) {
+			size_t i = ord[k];
+            const SpatGeom &g = v.getGeom(i);
             SpatVector p(g);
 			p.srs = v.srs;
 			std::vector<double> cell, wgt;
-			if (weights) {
-				rasterizeCellsWeights(cell, wgt, p);
-			} else if (exact) {
+			if (weights || exact) {
 				rasterizeCellsExact(cell, wgt, p);
 			} else {
 				cell = rasterizeCells(p, touches);
@@ -962,17 +1224,10 @@ std::vector<double> SpatRaster::vectCells(SpatVector v, bool touches, std::strin
 		SpatRaster r = geometry(1);
 		std::vector<double> feats(1, 1) ;		
         for (size_t i=0; i<ng; i++) {
-            SpatGeom g = v.getGeom(i);
+            const SpatGeom &g = v.getGeom(i);
             SpatVector p(g);
 			p.srs = v.srs;
-			if (weights) {
-				std::vector<double> cnr, wght;
-				rasterizeCellsWeights(cnr, wght, p);			
-				std::vector<double> id(cnr.size(), i);
-				out.insert(out.end(), id.begin(), id.end());
-				cells.insert(cells.end(), cnr.begin(), cnr.end());			
-				wghts.insert(wghts.end(), wght.begin(), wght.end());			
-			} else if (exact) {
+			if (weights || exact) {
 				std::vector<double> cnr, wght;
 				rasterizeCellsExact(cnr, wght, p);			
 				std::vector<double> id(cnr.size(), i);
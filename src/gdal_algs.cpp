@@ -669,45 +669,47 @@ SpatRaster SpatRaster::rectify(std::string method, SpatRaster aoi, unsigned usea
 
 
 
-SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggregate, SpatOptions &opt) {
+// polygonize the first layer of x into a new layer of poDS. GDAL's polygonizer
+// traces the raster line by line and writes each polygon to the layer as soon as
+// it is complete, so only the open polygons are held in memory
+static bool polygonize_layer(SpatRaster &x, GDALDataset *poDS, std::string lyrname, bool trunc, bool narm, std::string &msg, SpatOptions &opt) {
 
-	SpatVector out;
 	SpatOptions topt(opt);
-
-	if (nlyr() > 1) {
-		out.addWarning("only the first layer is polygonized when 'dissolve=TRUE'");
-	}
-	SpatRaster tmp = subset({0}, topt);
+	SpatRaster tmp = x.subset({0}, topt);
 
 	bool usemask = false;
 	SpatRaster mask;
+	if (trunc) {
+		// GDALPolygonize would round the values
+		tmp = tmp.math("trunc", topt);
+	}
 	if (narm) {
 		usemask = true;
 		mask = tmp.isfinite(topt);	
 	} else if (trunc) {
-		tmp = tmp.math("trunc", topt);
 		trunc = false;
 	} else if (tmp.sources_from_file()) {
 		// for NAN and INT files. Should have a check for that
-		//tmp = tmp.arith(0, "+", false, topt);
-		// riskier  
-		tmp.readAll();
+		if (tmp.canProcessInMemory(topt)) {
+			tmp.readAll();
+		} else {
+			// too large to read; polygonize a (temp file) copy instead
+			tmp = tmp.arith(0, "+", false, topt);
+		}
 	}
 	
-	
 	GDALDatasetH rstDS;
 	if (! tmp.sources_from_file() ) {
 		if (!tmp.open_gdal(rstDS, 0, false, topt)) {
-			out.setError("cannot open dataset");
-			return out;
+			msg = "cannot open dataset";
+			return false;
 		}
 	} else {
 		std::vector<std::string> ops;
 		rstDS = openGDAL(tmp.source[0].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, ops);
-		
 		if (rstDS == NULL) {
-			out.setError("cannot open dataset from file");
-			return out;
+			msg = "cannot open dataset from file";
+			return false;
 		}
 	}
     GDALDataset *srcDS=NULL;
@@ -723,17 +725,16 @@ SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggre
 		GDALDatasetH rstMask;
 		if (! mask.sources_from_file() ) {
 			if (!mask.open_gdal(rstMask, 0, false, opt)) {
-				out.setError("cannot open dataset");
-				return out;
+				GDALClose(srcDS);
+				msg = "cannot open dataset";
+				return false;
 			}
 		} else {
 			rstMask = openGDAL(mask.source[0].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, mask.source[0].open_ops);
-
-			//std::string filename = mask.source[0].filename;
-			//rstMask = GDALOpen( filename.c_str(), GA_ReadOnly);
 			if (rstMask == NULL) {
-				out.setError("cannot open dataset from file");
-				return out;		
+				GDALClose(srcDS);
+				msg = "cannot open dataset from file";
+				return false;
 			}
 		}
 #if GDAL_VERSION_MAJOR <= 2 && GDAL_VERSION_MINOR <= 2
@@ -743,74 +744,90 @@ SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggre
 #endif
 	}
 
-    GDALDataset *poDS = NULL;
-    GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( "Memory" );
-    if( poDriver == NULL )  {
-        out.setError( "cannot create output dataset");
-        return out;
-    }
-    poDS = poDriver->Create("", 0, 0, 0, GDT_Unknown, NULL );
-    if( poDS == NULL ) {
-        out.setError("Creation of dataset failed" );
-        return out;
-    }
-	std::vector<std::string> nms = getNames();
+	std::vector<std::string> nms = x.getNames();
 	std::string name = nms[0];
+	if (lyrname == "") lyrname = name;
 
 	OGRSpatialReference *SRS = NULL;
-	std::string s = source[0].srs.wkt;
+	std::string s = x.source[0].srs.wkt;
 	if (s != "") {
 		SRS = new OGRSpatialReference;
 		OGRErr err = SRS->SetFromUserInput(s.c_str()); 
 		if (err != OGRERR_NONE) {
-			out.setError("crs error");
 			delete SRS;
-			return out;
+			GDALClose(srcDS);
+			if (usemask) GDALClose(maskDS);
+			msg = "crs error";
+			return false;
 		}
 	}
 
     OGRLayer *poLayer;
-    poLayer = poDS->CreateLayer(name.c_str(), SRS, wkbPolygon, NULL );
+    poLayer = poDS->CreateLayer(lyrname.c_str(), SRS, wkbPolygon, NULL );
+	if (SRS != NULL) SRS->Release();
     if( poLayer == NULL ) {
-        out.setError( "Layer creation failed" );
-        return out;
+		GDALClose(srcDS);
+		if (usemask) GDALClose(maskDS);
+        msg = "Layer creation failed";
+        return false;
     }
-	if (SRS != NULL) SRS->Release();
 
 	OGRFieldDefn oField(name.c_str(), trunc ?  OFTInteger : OFTReal);
 	if( poLayer->CreateField( &oField ) != OGRERR_NONE ) {
-		out.setError( "Creating field failed");
-		return out;
+		GDALClose(srcDS);
+		if (usemask) GDALClose(maskDS);
+		msg = "Creating field failed";
+		return false;
 	}
 
 	GDALRasterBand  *poBand;
 	poBand = srcDS->GetRasterBand(1);
-
-	//int hasNA=1;
-	//double naflag = poBand->GetNoDataValue(&hasNA);
-
-	CPLErr err;
+	GDALRasterBand  *maskBand = NULL;
 	if (usemask) {
-		GDALRasterBand  *maskBand;
 		maskBand = maskDS->GetRasterBand(1);
-		if (trunc) {
-			err = GDALPolygonize(poBand, maskBand, poLayer, 0, NULL, NULL, NULL);
-		} else {
-			err = GDALFPolygonize(poBand, maskBand, poLayer, 0, NULL, NULL, NULL);
-		}
-		GDALClose(maskDS);
+	}
+
+	CPLErr err;
+	if (trunc) {
+		err = GDALPolygonize(poBand, maskBand, poLayer, 0, NULL, NULL, NULL);
 	} else {
-		if (trunc) {
-			err = GDALPolygonize(poBand, NULL, poLayer, 0, NULL, NULL, NULL);
-		} else {
-			err = GDALFPolygonize(poBand, NULL, poLayer, 0, NULL, NULL, NULL);
-		}
+		err = GDALFPolygonize(poBand, maskBand, poLayer, 0, NULL, NULL, NULL);
 	}
+	if (usemask) GDALClose(maskDS);
+	GDALClose(srcDS);
 	if (err == 4) {
-		out.setError("polygonize error");
+		msg = "polygonize error";
+		return false;
+	}
+	return true;
+}
+
+
+SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggregate, SpatOptions &opt) {
+
+	SpatVector out;
+	if (nlyr() > 1) {
+		out.addWarning("only the first layer is polygonized when 'dissolve=TRUE'");
+	}
+
+    GDALDataset *poDS = NULL;
+    GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( "Memory" );
+    if( poDriver == NULL )  {
+        out.setError( "cannot create output dataset");
+        return out;
+    }
+    poDS = poDriver->Create("", 0, 0, 0, GDT_Unknown, NULL );
+    if( poDS == NULL ) {
+        out.setError("Creation of dataset failed" );
+        return out;
+    }
+
+	std::string msg;
+	if (!polygonize_layer(*this, poDS, "", trunc, narm, msg, opt)) {
+		GDALClose(poDS);
+		out.setError(msg);
 		return out;
 	}
-	GDALClose(srcDS);
 
 	std::vector<double> fext;
 	SpatVector fvct;
@@ -818,7 +835,8 @@ SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggre
 	GDALClose(poDS);
 
 	if (aggregate && (out.nrow() > 0)) {
-		out = out.aggregate(name, false);
+		std::vector<std::string> nms = getNames();
+		out = out.aggregate(nms[0], false);
 	}
 
 	if (!values) {
@@ -827,6 +845,76 @@ SpatVector SpatRaster::polygonize(bool trunc, bool values, bool narm, bool aggre
 	return out;
 }
 
+
+bool SpatRaster::polygonize_file(std::string filename, std::string lyrname, std::string driver, bool trunc, bool narm, bool overwrite, SpatOptions &opt) {
+
+	if (!hasValues()) {
+		setError("raster has no values");
+		return false;
+	}
+	if (nlyr() > 1) {
+		addWarning("only the first layer is polygonized");
+	}
+	if (filename == "") {
+		setError("no filename");
+		return false;
+	}
+
+    GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( driver.c_str() );
+    if( poDriver == NULL )  {
+        setError( driver + " driver not available");
+        return false;
+    }
+    char **papszMetadata = poDriver->GetMetadata();
+    if (!CSLFetchBoolean( papszMetadata, GDAL_DCAP_VECTOR, FALSE)) {
+		setError(driver + " is not a vector format");
+        return false;
+	}
+    if (!CSLFetchBoolean( papszMetadata, GDAL_DCAP_CREATE, FALSE)) {
+		setError("cannot create a "+ driver + " dataset");
+        return false;
+	}
+	if (file_exists(filename)) {
+		if (!overwrite) {
+			setError("file exists. Use 'overwrite=TRUE' to overwrite it");
+			return false;
+		}
+		if (poDriver->Delete(filename.c_str()) != CE_None) {
+			setError("cannot overwrite existing file");
+			return false;
+		}
+	}
+
+    GDALDataset *poDS = poDriver->Create(filename.c_str(), 0, 0, 0, GDT_Unknown, NULL );
+    if( poDS == NULL ) {
+        setError("Creation of output dataset failed" );
+        return false;
+    }
+
+	// drivers such as GPKG are much faster when the features are not 
+	// committed one at a time
+	bool transaction = poDS->StartTransaction(FALSE) == OGRERR_NONE;
+
+	std::string msg;
+	bool success = polygonize_layer(*this, poDS, lyrname, trunc, narm, msg, opt);
+
+	if (transaction) {
+		if (success) {
+			if (poDS->CommitTransaction() != OGRERR_NONE) {
+				msg = "cannot commit features to file";
+				success = false;
+			}
+		} else {
+			poDS->RollbackTransaction();
+		}
+	}
+	GDALClose(poDS);
+	if (!success) {
+		setError(msg);
+	}
+	return success;
+}
+
 	
 	
 SpatRaster SpatRaster::rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt) {	
@@ -942,75 +1030,6 @@ SpatRaster SpatRaster::rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt)
 	return out;
 }
 
-	
-SpatRaster SpatRaster::sievefilter(int threshold, int connections, SpatOptions &opt) {	
-	SpatRaster out;
-	std::string filename = opt.get_filename();
-	std::string driver;
-	if (filename == "") {
-		if (canProcessInMemory(opt)) {
-			driver = "MEM";
-		} else {
-			filename = tempFile(opt.get_tempdir(), ".tif");
-			opt.set_filenames({filename});
-			driver = "GTiff";
-		} 
-	} else {
-		driver = opt.get_filetype();
-		getGDALdriver(filename, driver);
-		if (driver == "") {
-			setError("cannot guess file type from filename");
-			return out;
-		}
-		std::string errmsg;
-		if (!can_write(filename, opt.get_overwrite(), errmsg)) {
-			out.setError(errmsg);
-			return out;
-		}	
-	}
-
-	SpatOptions ops(opt);
-	GDALDatasetH hSrcDS, hDstDS;
-	if (!open_gdal(hSrcDS, 0, false, ops)) {
-		out.setError("cannot open input dataset");
-		return out;
-	}
-	
-	GDALDriverH hDriver = GDALGetDriverByName( driver.c_str() );
-	if ( hDriver == NULL ) {
-		out.setError("empty driver");
-		return out;
-	}
-	if (!out.create_gdalDS(hDstDS, filename, driver, true, 0, source[0].has_scale_offset, source[0].scale, source[0].offset, opt)) {
-		out.setError("cannot create new dataset");
-		GDALClose(hSrcDS);
-		return out;
-	}
-
-	GDALRasterBandH hSrcBand = GDALGetRasterBand(hSrcDS, 1);
-	GDALRasterBandH hTargetBand = GDALGetRasterBand(hDstDS, 1);
-
-	if (!GDALSieveFilter(hSrcBand, NULL, hTargetBand, threshold, connections, NULL, NULL, NULL)) {
-		out.setError("sieve failed");
-		GDALClose(hSrcDS);
-		GDALClose(hDstDS);
-		return out;
-	}	
-	
-	GDALClose(hSrcDS);
-	if (driver == "MEM") {
-		if (!out.from_gdalMEM(hDstDS, false, true)) {
-			out.setError("conversion failed (mem)");
-			GDALClose(hDstDS);
-			return out;
-		}
-	} else {
-		out = SpatRaster(filename, {-1}, {""}, {});
-	}
-	GDALClose(hDstDS);
-	return out;
-}
-
 
 /*	
 SpatRaster SpatRaster::fillna(int threshold, int connections, SpatOptions &opt) {	
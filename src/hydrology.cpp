@@ -0,0 +1,764 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include <queue>
+#include <unordered_map>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+// All methods in this file process the raster in blocks of rows ("tiles").
+// A first pass over the tiles computes what each tile passes on to the
+// others through its first and last row. These "perimeter" rows are linked
+// in a small graph that is solved in memory. A second pass over the tiles
+// uses the solution to compute the final values. Only one tile, and a few
+// values for each cell in the perimeter rows, are in memory at any time.
+// Based on Barnes (2016, 2017) for depression filling and flow accumulation.
+
+
+// the perimeter rows of the tiles (the first and last row of each block)
+class TilePerimeter {
+	public:
+		size_t nc = 0;
+		size_t nslots = 0;
+		std::vector<long> slot;  // for each row, the slot of a perimeter row, or -1
+
+		TilePerimeter(const BlockSize &bs, size_t nrow, size_t ncol) {
+			nc = ncol;
+			slot.resize(nrow, -1);
+			for (size_t i=0; i<bs.n; i++) {
+				slot[bs.row[i]] = nslots++;
+				size_t last = bs.row[i] + bs.nrows[i] - 1;
+				if (last > bs.row[i]) {
+					slot[last] = nslots++;
+				}
+			}
+		}
+		size_t size() { return nslots * nc; }
+		// the perimeter node of a cell; or -1 if it is not in a perimeter row
+		long node(size_t row, size_t col) {
+			return slot[row] < 0 ? -1 : slot[row] * nc + col;
+		}
+};
+
+
+// D8 flow direction codes (as computed by terrain(v="flowdir")) to the row and column offset of the
+// downstream cell. Starting with East and going clockwise: 1, 2, 4, 8, 16, 32, 64, 128
+bool d8_offset(double d, int &dr, int &dc) {
+	static const int offr[8] = { 0, 1, 1, 1, 0,-1,-1,-1};
+	static const int offc[8] = { 1, 1, 0,-1,-1,-1, 0, 1};
+	if (!((d >= 1) && (d <= 128))) return false;
+	int v = d;
+	if ((v != d) || ((v & (v-1)) != 0)) return false;
+	int k = 0;
+	while (v > 1) {
+		v >>= 1;
+		k++;
+	}
+	dr = offr[k];
+	dc = offc[k];
+	return true;
+}
+
+
+// the flow graph of a tile. For each cell, the downstream cell in the tile (down >= 0);
+// or the perimeter node of the downstream cell in another tile (-2 - node); or -1 if
+// the flow ends (no or invalid direction, the downstream cell is outside the raster or NA, or
+// the cell is not zero in "ends")
+class TileFlow {
+	public:
+		std::vector<long> down;
+		std::vector<size_t> order; // the cells, such that each cell comes before its downstream cell
+		std::vector<bool> done;    // false for cells in (or downstream of) a loop
+
+		TileFlow(const std::vector<double> &fd, size_t row, size_t nrows, size_t nr, size_t nc, TilePerimeter &tp, const std::vector<long> &ends = std::vector<long>()) {
+			size_t n = nrows * nc;
+			down.resize(n, -1);
+			std::vector<unsigned char> indeg(n, 0);
+			bool stop = !ends.empty();
+			for (size_t i=0; i<n; i++) {
+				int dr, dc;
+				if (stop && (ends[i] != 0)) continue;
+				if (!d8_offset(fd[i], dr, dc)) continue;
+				long r = (long) (i / nc) + dr;
+				long c = (long) (i % nc) + dc;
+				long gr = (long) row + r;
+				if ((c < 0) || (c >= (long) nc) || (gr < 0) || (gr >= (long) nr)) continue;
+				if ((r < 0) || (r >= (long) nrows)) {
+					down[i] = -2 - tp.node(gr, c);
+				} else {
+					size_t j = r * nc + c;
+					if (std::isnan(fd[j])) continue;
+					down[i] = j;
+					indeg[j]++;
+				}
+			}
+			// topological order (Kahn)
+			order.reserve(n);
+			for (size_t i=0; i<n; i++) {
+				if ((indeg[i] == 0) && (!std::isnan(fd[i]))) order.push_back(i);
+			}
+			for (size_t k=0; k<order.size(); k++) {
+				long j = down[order[k]];
+				if (j >= 0) {
+					indeg[j]--;
+					if (indeg[j] == 0) order.push_back(j);
+				}
+			}
+			done.resize(n, false);
+			for (size_t i : order) done[i] = true;
+		}
+};
+
+
+SpatRaster SpatRaster::flowAccumulation(SpatRaster weight, bool weighted, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"flowacc"});
+	if (nlyr() > 1) {
+		out.setError("flowAccumulation needs a single layer (flow direction) object");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	if (weighted) {
+		if (!compare_geom(weight, false, false, opt.get_tolerance())) {
+			out.setError(getError());
+			return(out);
+		}
+		if (weight.nlyr() > 1) {
+			out.setError("weight must have a single layer");
+			return out;
+		}
+		if (!weight.readStart()) {
+			out.setError(weight.getError());
+			return(out);
+		}
+	}
+
+	size_t nr = nrow();
+	size_t nc = ncol();
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	BlockSize bs = out.bs;
+	TilePerimeter tp(bs, nr, nc);
+
+	// first pass: the accumulation that flows out of each tile into each perimeter
+	// cell of another tile, and where the flow from each perimeter cell leaves the tile
+	std::vector<double> inflow(tp.size(), 0);
+	std::vector<long> exit(tp.size(), -1);
+	for (size_t b=0; b<bs.n; b++) {
+		std::vector<double> fd = readValues(bs.row[b], bs.nrows[b], 0, nc);
+		std::vector<double> w;
+		if (weighted) {
+			w = weight.readValues(bs.row[b], bs.nrows[b], 0, nc);
+		}
+		TileFlow tf(fd, bs.row[b], bs.nrows[b], nr, nc, tp);
+		size_t n = fd.size();
+		std::vector<double> acc(n, 1);
+		if (weighted) {
+			for (size_t i=0; i<n; i++) acc[i] = std::isnan(w[i]) ? 0 : w[i];
+		}
+		std::vector<long> ex(n, -1);
+		for (size_t i : tf.order) {
+			long j = tf.down[i];
+			if (j >= 0) {
+				acc[j] += acc[i];
+			} else if (j < -1) {
+				inflow[-2 - j] += acc[i];
+			}
+		}
+		for (size_t k=tf.order.size(); k>0; k--) {
+			size_t i = tf.order[k-1];
+			long j = tf.down[i];
+			if (j >= 0) {
+				ex[i] = ex[j];
+			} else if (j < -1) {
+				ex[i] = -2 - j;
+			}
+		}
+		for (size_t i=0; i<n; i++) {
+			long p = tp.node(bs.row[b] + i / nc, i % nc);
+			if (p >= 0) exit[p] = ex[i];
+		}
+	}
+
+	// the flow that enters each perimeter cell from other tiles; passed on along
+	// the graph of perimeter cells in topological order. Cells in loops get NAN
+	size_t np = tp.size();
+	std::vector<unsigned> indeg(np, 0);
+	for (size_t p=0; p<np; p++) {
+		if (exit[p] >= 0) indeg[exit[p]]++;
+	}
+	std::vector<size_t> order;
+	order.reserve(np);
+	for (size_t p=0; p<np; p++) {
+		if (indeg[p] == 0) order.push_back(p);
+	}
+	for (size_t k=0; k<order.size(); k++) {
+		long q = exit[order[k]];
+		if (q >= 0) {
+			inflow[q] += inflow[order[k]];
+			indeg[q]--;
+			if (indeg[q] == 0) order.push_back(q);
+		}
+	}
+	for (size_t p=0; p<np; p++) {
+		if (indeg[p] > 0) inflow[p] = NAN;
+	}
+
+	// second pass: accumulate within each tile, starting with the inflow
+	for (size_t b=0; b<bs.n; b++) {
+		std::vector<double> fd = readValues(bs.row[b], bs.nrows[b], 0, nc);
+		std::vector<double> w;
+		if (weighted) {
+			w = weight.readValues(bs.row[b], bs.nrows[b], 0, nc);
+		}
+		TileFlow tf(fd, bs.row[b], bs.nrows[b], nr, nc, tp);
+		size_t n = fd.size();
+		std::vector<double> acc(n, 1);
+		if (weighted) {
+			for (size_t i=0; i<n; i++) acc[i] = std::isnan(w[i]) ? 0 : w[i];
+		}
+		for (size_t i=0; i<n; i++) {
+			long p = tp.node(bs.row[b] + i / nc, i % nc);
+			if (p >= 0) acc[i] += inflow[p];
+		}
+		for (size_t i : tf.order) {
+			long j = tf.down[i];
+			if (j >= 0) acc[j] += acc[i];
+		}
+		for (size_t i=0; i<n; i++) {
+			if (!tf.done[i]) acc[i] = NAN;
+		}
+		if (!out.writeValues(acc, bs.row[b], bs.nrows[b], 0, nc)) return out;
+	}
+	out.writeStop();
+	readStop();
+	if (weighted) weight.readStop();
+	return out;
+}
+
+
+// the watershed label of each cell of a tile: the label of the first pour point
+// downstream; or (if the flow leaves the tile first) -2 - perimeter node. The flow
+// ends at the pour points, such that these can also be in a flow loop
+std::vector<long> tile_watershed(const std::vector<double> &fd, size_t row, size_t nrows, size_t nr, size_t nc, TilePerimeter &tp, std::vector<long> pour) {
+	for (size_t i=0; i<pour.size(); i++) {
+		if (std::isnan(fd[i])) pour[i] = 0;
+	}
+	TileFlow tf(fd, row, nrows, nr, nc, tp, pour);
+	std::vector<long> lab = pour;
+	for (size_t k=tf.order.size(); k>0; k--) {
+		size_t i = tf.order[k-1];
+		if (lab[i] > 0) continue;
+		long j = tf.down[i];
+		if (j >= 0) {
+			lab[i] = lab[j];
+		} else if (j < -1) {
+			lab[i] = j;
+		}
+	}
+	return lab;
+}
+
+
+SpatRaster SpatRaster::watershed(std::vector<double> cells, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"watershed"});
+	if (nlyr() > 1) {
+		out.setError("watershed needs a single layer (flow direction) object");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	size_t nr = nrow();
+	size_t nc = ncol();
+	double nce = ncell();
+	// pour point cells and their labels (1, 2, ...)
+	std::vector<std::pair<double, long>> pp;
+	for (size_t i=0; i<cells.size(); i++) {
+		if ((cells[i] >= 0) && (cells[i] < nce)) {
+			pp.push_back({cells[i], (long)i+1});
+		}
+	}
+	if (pp.empty()) {
+		out.setError("no pour points on the raster");
+		return out;
+	}
+	std::sort(pp.begin(), pp.end());
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	BlockSize bs = out.bs;
+	TilePerimeter tp(bs, nr, nc);
+
+	auto tile_pour = [&](size_t b) {
+		std::vector<long> pour(bs.nrows[b] * nc, 0);
+		double first = bs.row[b] * nc;
+		double last = first + pour.size();
+		auto it = std::lower_bound(pp.begin(), pp.end(), std::make_pair(first, (long)0));
+		for (; (it != pp.end()) && (it->first < last); it++) {
+			pour[(size_t)(it->first - first)] = it->second;
+		}
+		return pour;
+	};
+
+	// first pass: the label, or the next perimeter cell, of each perimeter cell
+	size_t np = tp.size();
+	std::vector<long> plab(np, 0);
+	for (size_t b=0; b<bs.n; b++) {
+		std::vector<double> fd = readValues(bs.row[b], bs.nrows[b], 0, nc);
+		std::vector<long> lab = tile_watershed(fd, bs.row[b], bs.nrows[b], nr, nc, tp, tile_pour(b));
+		for (size_t i=0; i<lab.size(); i++) {
+			long p = tp.node(bs.row[b] + i / nc, i % nc);
+			if (p >= 0) plab[p] = lab[i];
+		}
+	}
+
+	// resolve the labels of the perimeter cells by following the flow to a pour point
+	std::vector<size_t> path;
+	for (size_t p=0; p<np; p++) {
+		long q = p;
+		while (plab[q] < -1) {
+			path.push_back(q);
+			long next = -2 - plab[q];
+			plab[q] = -1; // in progress; to stop at loops
+			q = next;
+		}
+		long v = plab[q] < 0 ? 0 : plab[q];
+		for (size_t k : path) plab[k] = v;
+		path.resize(0);
+	}
+
+	// second pass
+	for (size_t b=0; b<bs.n; b++) {
+		std::vector<double> fd = readValues(bs.row[b], bs.nrows[b], 0, nc);
+		std::vector<long> lab = tile_watershed(fd, bs.row[b], bs.nrows[b], nr, nc, tp, tile_pour(b));
+		std::vector<double> v(lab.size());
+		for (size_t i=0; i<lab.size(); i++) {
+			if (std::isnan(fd[i])) {
+				v[i] = NAN;
+			} else if (lab[i] < -1) {
+				v[i] = plab[-2 - lab[i]];
+			} else {
+				v[i] = lab[i];
+			}
+		}
+		if (!out.writeValues(v, bs.row[b], bs.nrows[b], 0, nc)) return out;
+	}
+	out.writeStop();
+	readStop();
+	return out;
+}
+
+
+struct PairHash {
+	size_t operator()(const std::pair<size_t, size_t> &p) const {
+		return std::hash<size_t>()(p.first) ^ (std::hash<size_t>()(p.second) * 31);
+	}
+};
+
+typedef std::unordered_map<std::pair<size_t, size_t>, double, PairHash> LabelEdges;
+
+// the lowest elevation at which water can flow between labels a and b 
+void add_edge(LabelEdges &edges, size_t a, size_t b, double z) {
+	if (a > b) std::swap(a, b);
+	auto it = edges.find({a, b});
+	if (it == edges.end()) {
+		edges[{a, b}] = z;
+	} else if (z < it->second) {
+		it->second = z;
+	}
+}
+
+
+// priority-flood of a tile (Barnes et al., 2014). The cells on the edge of the raster,
+// or next to a NA cell, drain ("ocean", label 1). The other cells in the first and last
+// row of the tile each get their own label. Each label spreads to the cells it floods. "wl"
+// gets the flooded elevation, that is, the lowest elevation at which water can flow from
+// the cell to the source of its label. "edges" gets the lowest elevation at which water
+// can flow between two labels (if edges is not NULL)
+void tile_flood(const std::vector<double> &d, size_t row, size_t nrows, size_t nr, size_t nc, size_t base, std::vector<double> &wl, std::vector<size_t> &lab, LabelEdges *edges) {
+
+	// d has a row above and below the tile
+	const double *e = &d[nc];
+	size_t n = nrows * nc;
+	wl.assign(e, e + n);
+	lab.assign(n, 0);
+
+	typedef std::pair<double, size_t> Cell;
+	std::priority_queue<Cell, std::vector<Cell>, std::greater<Cell>> open;
+
+	for (size_t i=0; i<n; i++) {
+		if (std::isnan(e[i])) continue;
+		size_t r = i / nc;
+		size_t c = i % nc;
+		size_t gr = row + r;
+		bool ocean = (c == 0) || (c == nc-1) || (gr == 0) || (gr == nr-1);
+		if (!ocean) {
+			for (int dr=-1; dr<2; dr++) {
+				for (int dc=-1; dc<2; dc++) {
+					if (std::isnan(e[(long)i + dr * (long)nc + dc])) ocean = true;
+				}
+			}
+		}
+		if (ocean) {
+			lab[i] = 1;
+		} else if (r == 0) {
+			lab[i] = base + c;
+		} else if (r == nrows-1) {
+			lab[i] = base + nc + c;
+		} else {
+			continue;
+		}
+		open.push({e[i], i});
+	}
+
+	while (!open.empty()) {
+		size_t i = open.top().second;
+		open.pop();
+		long r = i / nc;
+		long c = i % nc;
+		for (int dr=-1; dr<2; dr++) {
+			long rr = r + dr;
+			if ((rr < 0) || (rr >= (long)nrows)) continue;
+			for (int dc=-1; dc<2; dc++) {
+				long cc = c + dc;
+				if ((cc < 0) || (cc >= (long)nc)) continue;
+				size_t j = rr * nc + cc;
+				if (std::isnan(e[j])) continue;
+				if (lab[j] == 0) {
+					lab[j] = lab[i];
+					wl[j] = std::max(e[j], wl[i]);
+					open.push({wl[j], j});
+				} else if ((edges != NULL) && (lab[j] != lab[i])) {
+					add_edge(*edges, lab[i], lab[j], std::max(wl[i], wl[j]));
+				}
+			}
+		}
+	}
+}
+
+
+// the value that is k single precision steps above x. The result is larger than x, 
+// also when it is written to file as FLT4S (k > 0)
+double step_up(double x, size_t k) {
+	float f = x;
+	if (f < x) f = std::nextafter(f, std::numeric_limits<float>::infinity());
+	while ((k > 0) && (f <= 0)) {
+		f = std::nextafter(f, std::numeric_limits<float>::infinity());
+		k--;
+	}
+	if (k > 0) {
+		// for positive floats, the next value has the next integer representation
+		uint32_t u;
+		std::memcpy(&u, &f, sizeof(float));
+		u += k;
+		std::memcpy(&f, &u, sizeof(float));
+	}
+	return f;
+}
+
+
+// the distance (in cells) from each cell of a tile to a cell with a lower neighbour, or to 
+// a cell on the edge of the raster or next to a NA cell, through cells with the same (filled) 
+// elevation. "f" has the filled elevation of the tile, with the rows above and below it (NAN 
+// if outside the raster); "e" has the unfilled elevation in the same layout. "above" and 
+// "below" have the distances of the row above and below the tile (or are empty)
+void flat_distance(const std::vector<double> &f, const std::vector<double> &e, size_t row, size_t nrows, size_t nr, size_t nc, const std::vector<size_t> &above, const std::vector<size_t> &below, std::vector<size_t> &dist) {
+
+	const size_t inf = std::numeric_limits<size_t>::max();
+	size_t n = nrows * nc;
+	dist.assign(n, inf);
+	typedef std::pair<size_t, size_t> Cell;
+	std::priority_queue<Cell, std::vector<Cell>, std::greater<Cell>> open;
+	for (size_t i=0; i<n; i++) {
+		long k = i + nc; 
+		double z = f[k];
+		if (std::isnan(z)) continue;
+		size_t r = i / nc;
+		size_t c = i % nc;
+		size_t gr = row + r;
+		bool drain = (c == 0) || (c == nc-1) || (gr == 0) || (gr == nr-1);
+		size_t d = inf;
+		for (int dr=-1; dr<2; dr++) {
+			for (int dc=-1; dc<2; dc++) {
+				long cc = c + dc;
+				if ((cc < 0) || (cc >= (long)nc)) continue;
+				long j = k + dr * (long)nc + dc;
+				if (std::isnan(e[j]) || (f[j] < z)) {
+					drain = true;
+				} else if ((f[j] == z) && (((r == 0) && (dr < 0)) || ((r == nrows-1) && (dr > 0)))) {
+					// a cell with the same elevation in another tile
+					const std::vector<size_t> &nb = dr < 0 ? above : below;
+					if ((!nb.empty()) && (nb[cc] < inf)) d = std::min(d, nb[cc] + 1);
+				}
+			}
+		}
+		if (drain) d = 0;
+		if (d < inf) {
+			dist[i] = d;
+			open.push({d, i});
+		}
+	}
+	while (!open.empty()) {
+		size_t d = open.top().first;
+		size_t i = open.top().second;
+		open.pop();
+		if (d > dist[i]) continue;
+		long r = i / nc;
+		long c = i % nc;
+		double z = f[i + nc];
+		for (int dr=-1; dr<2; dr++) {
+			long rr = r + dr;
+			if ((rr < 0) || (rr >= (long)nrows)) continue;
+			for (int dc=-1; dc<2; dc++) {
+				long cc = c + dc;
+				if ((cc < 0) || (cc >= (long)nc)) continue;
+				size_t j = rr * nc + cc;
+				if ((f[j + nc] == z) && (dist[j] > (d + 1))) {
+					dist[j] = d + 1;
+					open.push({d + 1, j});
+				}
+			}
+		}
+	}
+}
+
+
+SpatRaster SpatRaster::fillDepressions(bool epsilon, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	if (nlyr() > 1) {
+		out.setError("fillDepressions needs a single layer (elevation) object");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	size_t nr = nrow();
+	size_t nc = ncol();
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	BlockSize bs = out.bs;
+
+	auto read_tile = [&](size_t b) {
+		size_t row = bs.row[b];
+		size_t nrows = bs.nrows[b];
+		size_t start = row == 0 ? 0 : row - 1;
+		size_t end = std::min(nr, row + nrows + 1);
+		std::vector<double> d = readValues(start, end - start, 0, nc);
+		if (row == 0) d.insert(d.begin(), nc, NAN);
+		if ((row + nrows) == nr) d.insert(d.end(), nc, NAN);
+		return d;
+	};
+
+	// first pass: the graph of labels. Label 0 is not used, 1 is the "ocean",
+	// and tile b uses 2 + b * 2 * nc, ... for its first and last row
+	LabelEdges edges;
+	std::vector<double> prev_e;
+	std::vector<size_t> prev_lab;
+	for (size_t b=0; b<bs.n; b++) {
+		std::vector<double> d = read_tile(b);
+		std::vector<double> wl;
+		std::vector<size_t> lab;
+		size_t nrows = bs.nrows[b];
+		tile_flood(d, bs.row[b], nrows, nr, nc, 2 + b * 2 * nc, wl, lab, &edges);
+		// the edges with the last row of the previous tile
+		if (b > 0) {
+			for (size_t c=0; c<nc; c++) {
+				if (std::isnan(prev_e[c])) continue;
+				for (int dc=-1; dc<2; dc++) {
+					long cc = c + dc;
+					if ((cc < 0) || (cc >= (long)nc) || std::isnan(wl[cc])) continue;
+					if (prev_lab[c] != lab[cc]) {
+						add_edge(edges, prev_lab[c], lab[cc], std::max(prev_e[c], wl[cc]));
+					}
+				}
+			}
+		}
+		size_t off = (nrows - 1) * nc;
+		prev_e.assign(wl.begin() + off, wl.end());
+		prev_lab.assign(lab.begin() + off, lab.end());
+	}
+
+	// the lowest level at which water can flow from each label to the ocean
+	size_t nlab = 2 + bs.n * 2 * nc;
+	std::vector<std::vector<std::pair<size_t, double>>> graph(nlab);
+	for (auto &it : edges) {
+		graph[it.first.first].push_back({it.first.second, it.second});
+		graph[it.first.second].push_back({it.first.first, it.second});
+	}
+	edges.clear();
+	std::vector<double> level(nlab, std::numeric_limits<double>::infinity());
+	level[1] = -std::numeric_limits<double>::infinity();
+	typedef std::pair<double, size_t> Node;
+	std::priority_queue<Node, std::vector<Node>, std::greater<Node>> open;
+	open.push({level[1], 1});
+	while (!open.empty()) {
+		double h = open.top().first;
+		size_t a = open.top().second;
+		open.pop();
+		if (h > level[a]) continue;
+		for (auto &e : graph[a]) {
+			double z = std::max(h, e.second);
+			if (z < level[e.first]) {
+				level[e.first] = z;
+				open.push({z, e.first});
+			}
+		}
+	}
+	graph.clear();
+
+	// a tile filled up to the level of its labels 
+	auto fill_tile = [&](size_t b, std::vector<double> &d) {
+		d = read_tile(b);
+		std::vector<double> wl;
+		std::vector<size_t> lab;
+		tile_flood(d, bs.row[b], bs.nrows[b], nr, nc, 2 + b * 2 * nc, wl, lab, NULL);
+		for (size_t i=0; i<wl.size(); i++) {
+			if (std::isnan(wl[i])) continue;
+			double h = level[lab[i]];
+			if (std::isfinite(h) && (h > wl[i])) wl[i] = h;
+		}
+		return wl;
+	};
+
+	if (!epsilon) {
+		// second pass: fill each tile 
+		for (size_t b=0; b<bs.n; b++) {
+			std::vector<double> d;
+			std::vector<double> wl = fill_tile(b, d);
+			if (!out.writeValues(wl, bs.row[b], bs.nrows[b], 0, nc)) return out;
+		}
+		out.writeStop();
+		readStop();
+		return out;
+	}
+
+	// with epsilon, the cells of a flat area (including a filled depression) are raised with 
+	// the smallest possible steps, according to their distance to the outlet of the area
+	// (Barnes et al., 2014, "priority-flood+epsilon"), such that each cell has a lower neighbour 
+	// and flow directions can be computed. The distances between tiles are found by passing 
+	// over the tiles (down and up) until the distances in the perimeter rows do not change
+	TilePerimeter tp(bs, nr, nc);
+	std::vector<double> pf(tp.size(), NAN);
+	for (size_t b=0; b<bs.n; b++) {
+		std::vector<double> d;
+		std::vector<double> wl = fill_tile(b, d);
+		size_t last = (bs.nrows[b] - 1) * nc;
+		for (size_t c=0; c<nc; c++) {
+			pf[tp.node(bs.row[b], c)] = wl[c];
+			pf[tp.node(bs.row[b] + bs.nrows[b] - 1, c)] = wl[last + c];
+		}
+	}
+
+	const size_t inf = std::numeric_limits<size_t>::max();
+	std::vector<size_t> pdist(tp.size(), inf);
+	// the distances of the cells of tile b, with the filled elevation in "wl"
+	auto tile_distance = [&](size_t b, std::vector<double> &wl, std::vector<size_t> &dist) {
+		std::vector<double> d;
+		wl = fill_tile(b, d);
+		size_t row = bs.row[b];
+		size_t nrows = bs.nrows[b];
+		std::vector<double> f(nc, NAN);
+		std::vector<size_t> above, below;
+		if (b > 0) {
+			size_t off = tp.node(row-1, 0);
+			std::copy(pf.begin() + off, pf.begin() + off + nc, f.begin());
+			above.assign(pdist.begin() + off, pdist.begin() + off + nc);
+		} 
+		f.insert(f.end(), wl.begin(), wl.end());
+		if ((b+1) < bs.n) {
+			size_t off = tp.node(row + nrows, 0);
+			f.insert(f.end(), pf.begin() + off, pf.begin() + off + nc);
+			below.assign(pdist.begin() + off, pdist.begin() + off + nc);
+		} else {
+			f.resize(f.size() + nc, NAN);
+		}
+		flat_distance(f, d, row, nrows, nr, nc, above, below, dist);
+	};
+
+	if (bs.n > 1) {
+		bool changed = true;
+		bool down = true;
+		while (changed) {
+			changed = false;
+			for (size_t k=0; k<bs.n; k++) {
+				size_t b = down ? k : bs.n - 1 - k;
+				std::vector<double> wl;
+				std::vector<size_t> dist;
+				tile_distance(b, wl, dist);
+				size_t last = (bs.nrows[b] - 1) * nc;
+				size_t first = tp.node(bs.row[b], 0);
+				size_t lastp = tp.node(bs.row[b] + bs.nrows[b] - 1, 0);
+				for (size_t c=0; c<nc; c++) {
+					if ((pdist[first + c] != dist[c]) || (pdist[lastp + c] != dist[last + c])) {
+						changed = true;
+						pdist[first + c] = dist[c];
+						pdist[lastp + c] = dist[last + c];
+					}
+				}
+			}
+			down = !down;
+		}
+	}
+
+	// second pass: write the filled and raised tiles
+	for (size_t b=0; b<bs.n; b++) {
+		std::vector<double> wl;
+		std::vector<size_t> dist;
+		tile_distance(b, wl, dist);
+		for (size_t i=0; i<wl.size(); i++) {
+			if ((dist[i] > 0) && (dist[i] < inf)) {
+				wl[i] = step_up(wl[i], dist[i]);
+			}
+		}
+		if (!out.writeValues(wl, bs.row[b], bs.nrows[b], 0, nc)) return out;
+	}
+	out.writeStop();
+	readStop();
+	return out;
+}
@@ -24,6 +24,9 @@
 #include "math_utils.h"
 #include "file_utils.h"
 #include "string_utils.h"
+#include "spatIndex.h"
+#include <unordered_map>
+#include <limits>
 
 
 /*
@@ -413,6 +416,89 @@ SpatRaster SpatRaster::separate(std::vector<double> classes, double keepvalue, d
 }
 
 
+// values (or only presence) keyed by number, for is_in and classify. Keys outside the range of 
+// the keys are rejected first. A direct lookup table is used if all keys are integers and their 
+// range is smaller than ValueTable_maxrange (or 8 times the number of keys); otherwise a hash map. 
+// NAN keys are ignored, and the first value for a key is used
+static const double ValueTable_maxrange = 1048576;
+
+template <typename T>
+class ValueTable {
+	private:
+		double mn = std::numeric_limits<double>::infinity();
+		double mx = -std::numeric_limits<double>::infinity();
+		bool uselut = false;
+		std::vector<T> lut;
+		std::vector<char> inlut;
+		std::unordered_map<double, T> map;
+
+		void init(const std::vector<double> &keys, const std::vector<T> *values) {
+			bool allint = true;
+			for (size_t j=0; j<keys.size(); j++) {
+				if (std::isnan(keys[j])) continue;
+				mn = std::min(mn, keys[j]);
+				mx = std::max(mx, keys[j]);
+				if (keys[j] != std::round(keys[j])) allint = false;
+			}
+			uselut = allint && (mx >= mn) && ((mx - mn) < std::max(ValueTable_maxrange, 8.0 * keys.size()));
+			if (uselut) {
+				size_t n = mx - mn + 1;
+				inlut.resize(n, 0);
+				if (values != NULL) lut.resize(n);
+			} else {
+				map.reserve(keys.size());
+			}
+			for (size_t j=0; j<keys.size(); j++) {
+				if (std::isnan(keys[j])) continue;
+				T v = (values == NULL) ? T() : (*values)[j];
+				if (uselut) {
+					size_t k = keys[j] - mn;
+					if (!inlut[k]) {
+						if (values != NULL) lut[k] = v;
+						inlut[k] = 1;
+					}
+				} else {
+					map.emplace(keys[j], v);
+				}
+			}
+		}
+		// position in the lookup table, or -1
+		inline long lutpos(const double &x) const {
+			double k = x - mn;
+			if (k != std::round(k)) return -1;
+			return inlut[(size_t)k] ? (long) k : -1;
+		}
+
+	public:
+		ValueTable() {}
+		ValueTable(const std::vector<double> &keys) {
+			init(keys, NULL);
+		}
+		ValueTable(const std::vector<double> &keys, const std::vector<T> &values) {
+			init(keys, &values);
+		}
+		// x should not be NAN
+		bool has(const double &x) const {
+			if ((x < mn) || (x > mx)) return false;
+			if (uselut) return lutpos(x) >= 0;
+			return map.find(x) != map.end();
+		}
+		bool find(const double &x, T &out) const {
+			if ((x < mn) || (x > mx)) return false;
+			if (uselut) {
+				long k = lutpos(x);
+				if (k < 0) return false;
+				out = lut[k];
+				return true;
+			}
+			auto it = map.find(x);
+			if (it == map.end()) return false;
+			out = it->second;
+			return true;
+		}
+};
+
+
 SpatRaster SpatRaster::is_in(std::vector<double> m, SpatOptions &opt) {
 
 	SpatRaster out = geometry();
@@ -438,7 +524,7 @@ SpatRaster SpatRaster::is_in(std::vector<double> m, SpatOptions &opt) {
 	}
 
 
-	// if m is very long, perhaps first check if the value is in range?
+	ValueTable<double> mset(m);
 
 	if (!readStart()) {
 		out.setError(getError());
@@ -456,12 +542,7 @@ SpatRaster SpatRaster::is_in(std::vector<double> m, SpatOptions &opt) {
 			if (std::isnan(v[j])) {
 				vv[j] = hasNAN;
 			} else {
-				for (size_t k=0; k<m.size(); k++) {
-					if (v[j] == m[k]) {
-						vv[j] = 1;
-						break;
-					}
-				}
+				vv[j] = mset.has(v[j]);
 			}
 		} 
 	
@@ -496,6 +577,8 @@ std::vector<std::vector<double>> SpatRaster::is_in_cells(std::vector<double> m,
 		//nanOnly=true;
 //	}
 
+	ValueTable<double> mset(m);
+
 	if (!readStart()) {
 		return(out);
 	}
@@ -510,13 +593,8 @@ std::vector<std::vector<double>> SpatRaster::is_in_cells(std::vector<double> m,
 			size_t cell = j % cellperlayer + bs.row[i] * nc;
 			if (std::isnan(v[j])) {
 				if (hasNAN)	out[lyr].push_back(cell);
-			} else {
-				for (size_t k=0; k<m.size(); k++) {
-					if (v[j] == m[k]) {
-						out[lyr].push_back(cell);
-						break;
-					}
-				}
+			} else if (mset.has(v[j])) {
+				out[lyr].push_back(cell);
 			}
 		} 
 	}
@@ -828,6 +906,61 @@ SpatRaster SpatRaster::mask(SpatVector x, bool inverse, double updatevalue, bool
 		out.setError("SpatRaster has no values");
 		return out;
 	}
+
+	if (x.type() == "polygons") {
+		// scanline rasterization of the polygons that overlap with each block
+		out = geometry(nlyr(), true);
+		std::vector<SpatExtent> exts(x.size());
+		for (size_t i=0; i<exts.size(); i++) {
+			exts[i] = x.geoms[i].extent;
+		}
+		SpatIndex index(exts);
+		if (!readStart()) {
+			out.setError(getError());
+			return(out);
+		}
+		if (!out.writeStart(opt)) {
+			readStop();
+			return out;
+		}
+		SpatExtent e = getExtent();
+		double ry = yres();
+		size_t nc = ncol();
+		size_t nl = nlyr();
+		for (size_t i=0; i < out.bs.n; i++) {
+			size_t nr = out.bs.nrows[i];
+			SpatExtent eb(e.xmin, e.xmax, e.ymax - (out.bs.row[i] + nr) * ry, e.ymax - out.bs.row[i] * ry);
+			SpatRaster b(nr, nc, 1, eb, "");
+			size_t ncls = nr * nc;
+			std::vector<bool> inpol(ncls, false);
+			std::vector<size_t> hits = index.query(eb);
+			std::vector<double> cells, weights;
+			for (size_t j : hits) {
+				if (touches) {
+					b.polygon_cells_exact(x.geoms[j], cells, weights);
+				} else {
+					cells = b.polygon_cells(x.geoms[j]);
+				}
+				for (double &c : cells) inpol[c] = true;
+			}
+			std::vector<double> v = readBlock(out.bs, i);
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				size_t off = lyr * ncls;
+				for (size_t j=0; j<ncls; j++) {
+					if (inpol[j] == inverse) {
+						if (inverse || (!std::isnan(v[off+j]))) {
+							v[off+j] = updatevalue;
+						}
+					}
+				}
+			}
+			if (!out.writeValues(v, out.bs.row[i], nr, 0, nc)) return out;
+		}
+		out.writeStop();
+		readStop();
+		return(out);
+	}
+
 	if (inverse) {
 		out = rasterizeLyr(x, updatevalue, NAN, touches, true, opt);
 	} else {
@@ -2231,8 +2364,191 @@ SpatRaster SpatRasterCollection::merge(SpatOptions &opt) {
 
 
 
-SpatRaster SpatRasterCollection::merge(SpatOptions &opt) {
-	return mosaic("first", opt);
+bool vrt_sources(std::vector<SpatRaster> &ds, SpatRaster &out, std::vector<std::string> &f) {
+	unsigned nl = out.nlyr();
+	for (size_t i=0; i<ds.size(); i++) {
+		if (ds[i].nsrc() > 1) return false;
+		SpatRasterSource &s = ds[i].source[0];
+		if (s.memory || s.hasWindow || s.multidim || s.hasNAflag) return false;
+		if ((s.nlyr != nl) || (s.nlyrfile != nl) || (!s.in_order())) return false;
+		if (!ds[i].shared_basegeom(out, 0.1, false)) return false;
+		f.push_back(s.filename);
+	}
+	return true;
+}
+
+
+SpatRaster SpatRasterCollection::merge(bool vrt, SpatOptions &opt) {
+
+	SpatRaster out;
+	unsigned n = size();
+
+	if (n == 0) {
+		out.setError("empty collection");
+		return(out);
+	}
+	if (n == 1) {
+		out = ds[0].deepCopy();
+		return(out);
+	}
+
+	std::vector<bool> hvals(n);
+	hvals[0] = ds[0].hasValues();
+	SpatExtent e = ds[0].getExtent();
+	unsigned nl = ds[0].nlyr();
+	for (size_t i=1; i<n; i++) {
+									//  lyrs, crs, warncrs, ext, rowcol, res
+		if (!ds[0].compare_geom(ds[i], false, false, opt.get_tolerance(), false, false, false, true)) {
+			out.setError(ds[0].msg.error);
+			return(out);
+		}		
+		e.unite(ds[i].getExtent());
+		hvals[i] = ds[i].hasValues();
+		nl = std::max(nl, ds[i].nlyr());
+	}
+	out = ds[0].geometry(nl, false);
+	out.setExtent(e, true, "");
+	
+	for (int i=(n-1); i>=0; i--) {
+		if (!hvals[i]) {
+			erase(i);
+		}
+	}
+	n = size();
+	if (n == 0) {
+		return out;
+	}	
+
+	if (vrt) {
+		std::string filename = opt.get_filename();
+		if (filename != "") {
+			std::string ext = getFileExt(filename);
+			lowercase(ext);
+			if (ext != ".vrt") {
+				out.setError("the filename must have a '.vrt' extension if vrt=TRUE");
+				return out;
+			}
+		}
+		std::vector<std::string> f;
+		if (vrt_sources(ds, out, f)) {
+			// in a vrt the last source has priority
+			std::reverse(f.begin(), f.end());
+			return out.make_vrt(f, opt);
+		}
+		out.addWarning("cannot make a vrt for these data (they must be aligned files with all layers); the values were copied");
+	}
+
+	std::string warn = "";
+	for (size_t i=0; i<n; i++) {
+		SpatOptions topt(opt);
+		if(!ds[i].shared_basegeom(out, 0.1, true)) {
+			SpatRaster temp = out.crop(ds[i].getExtent(), "near", topt);
+			std::vector<bool> hascats = ds[i].hasCategories();
+			std::string method = hascats[0] ? "near" : "bilinear";
+			ds[i] = ds[i].warper(temp, "", method, false, topt);
+			if (ds[i].hasError()) {
+				out.setError(ds[i].getError());
+				return out;
+			}
+			warn = "rasters did not align and were resampled";
+		}
+	}
+	if (warn != "") out.addWarning(warn);
+
+	// only the inputs that overlap with a block are read 
+	std::vector<SpatExtent> exts(n);
+	for (size_t i=0; i<n; i++) {
+		exts[i] = ds[i].getExtent();
+	}
+	SpatIndex index(exts);
+
+ 	if (!out.writeStart(opt)) { return out; }
+
+	SpatExtent eout = out.getExtent();
+	double hxr = out.xres()/2;
+	double hyr = out.yres()/2;
+	std::vector<std::vector<size_t>> hits(out.bs.n);
+	// the last block an input is needed for, so that it can be closed 
+	std::vector<size_t> lastblock(n, 0);
+	for (size_t i=0; i < out.bs.n; i++) {
+		eout.ymax = out.yFromRow(out.bs.row[i]) + hyr;
+		eout.ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i] - 1) - hyr;
+		std::vector<size_t> q = index.query(eout);
+		for (size_t j : q) {
+			e = exts[j];
+			e.intersect(eout);
+			if (e.valid_notequal()) {
+				hits[i].push_back(j);
+				lastblock[j] = i;
+			}
+		}
+	}
+
+	size_t nc = out.ncol();
+	std::vector<bool> isopen(n, false);
+	for (size_t i=0; i < out.bs.n; i++) {
+		eout.ymax = out.yFromRow(out.bs.row[i]) + hyr;
+		eout.ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i] - 1) - hyr;
+		size_t nr = out.bs.nrows[i];
+		size_t ncls = nr * nc;
+		std::vector<double> v(ncls * nl, NAN);
+		size_t nmiss = v.size();
+		for (size_t j : hits[i]) {
+			if (nmiss == 0) break;
+			SpatRaster &r = ds[j];
+			if (!isopen[j]) {
+				if (!r.readStart()) {
+					out.setError(r.getError());
+					out.writeStop();
+					return out;
+				}
+				isopen[j] = true;
+			}
+			e = exts[j];
+			e.intersect(eout);
+			int_64 r1 = r.rowFromY(e.ymax - hyr);
+			int_64 r2 = r.rowFromY(e.ymin + hyr);
+			int_64 c1 = r.colFromX(e.xmin + hxr);
+			int_64 c2 = r.colFromX(e.xmax - hxr);
+			if ((r1 < 0) || (c1 < 0) || (r2 < r1) || (c2 < c1)) continue;
+			int_64 orow = out.rowFromY(r.yFromRow(r1)) - out.bs.row[i];
+			int_64 ocol = out.colFromX(r.xFromCol(c1));
+			if ((orow < 0) || (ocol < 0)) continue;
+			size_t nrr = std::min((size_t)(r2 - r1 + 1), (size_t)(nr - orow));
+			size_t ncc = std::min((size_t)(c2 - c1 + 1), (size_t)(nc - ocol));
+			std::vector<double> rv = r.readValues(r1, nrr, c1, ncc);
+			if (r.hasError()) {
+				out.setError(r.getError());
+				out.writeStop();
+				return out;
+			}
+			size_t rnl = r.nlyr();
+			size_t rcls = nrr * ncc;
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				size_t roff = (lyr % rnl) * rcls;
+				size_t off = lyr * ncls + orow * nc + ocol;
+				for (size_t row=0; row<nrr; row++) {
+					size_t a = off + row * nc;
+					size_t b = roff + row * ncc;
+					for (size_t col=0; col<ncc; col++) {
+						if (std::isnan(v[a+col]) && (!std::isnan(rv[b+col]))) {
+							v[a+col] = rv[b+col];
+							nmiss--;
+						}
+					}
+				}
+			}
+		}
+		for (size_t j : hits[i]) {
+			if (isopen[j] && (lastblock[j] == i)) {
+				ds[j].readStop();
+				isopen[j] = false;
+			}
+		}
+		if (!out.writeValues(v, out.bs.row[i], nr, 0, nc)) return out;
+	}
+	out.writeStop();
+	return(out);
 }
 
 
@@ -2639,289 +2955,239 @@ SpatRaster SpatRaster::scale(std::vector<double> center, bool docenter, std::vec
 }
 
 
-void reclass_vector(std::vector<double> &v, std::vector<std::vector<double>> rcl, unsigned doright, bool lowest, bool othNA) {
-
-	size_t nc = rcl.size(); // should be 2 or 3
-	if (nc == 2) {
-		doright = 3; // should be 2?
-	}
-	bool right = false;
-	bool leftright = false;
-	if (doright > 1) {
-		leftright = true;
-	} else if (doright) {
-		right = true;
-	}
-
-//	bool hasNA = false;
-	double NAval = NAN;
-
-	size_t n = v.size();
-	unsigned nr = rcl[0].size();
-
-	if (nc == 1) {
-		std::vector<double> rc = rcl[0];
-		std::sort(rc.begin(), rc.end());
-		if (right) {   // interval closed at left and right
-			if (lowest)	{
-				for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						v[i] = NAval;
-					} else if ((v[i] < rc[0]) | (v[i] > rc[nr-1])) {
-						v[i] = NAval;
-					} else {
-						for (size_t j=1; j<nr; j++) {
-							if (v[i] <= rc[j]) {
-								v[i] = j-1;
-								break;
-							}
-						}
-					}
-				}
-			} else {
-				for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						v[i] = NAval;
-					} else if ((v[i] <= rc[0]) | (v[i] > rc[nr-1])) {
-						v[i] = NAval;
-					} else {
-						for (size_t j=1; j<nr; j++) {
-							if (v[i] <= rc[j]) {
-								v[i] = j-1;
-								break;
-							}
-						}
-					}
-				}
-			}
-		} else {
-			if (lowest)	{
-				for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						v[i] = NAval;
-					} else if ((v[i] < rc[0]) | (v[i] > rc[nr-1])) {
-						v[i] = NAval;
-					} else if (v[i] == rc[nr-1]) {
-						v[i] = nr-1;
-					} else {
-						for (size_t j=1; j<nr; j++) {
-							if (v[i] < rc[j]) {
-								v[i] = j-1;
-								break;
-							}
-						}
-					}
-				}
-			} else {
-				for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						v[i] = NAval;
-					} else if ((v[i] < rc[0]) | (v[i] >= rc[nr-1])) {
-						v[i] = NAval;
-					} else {
-						for (size_t j=1; j<nr; j++) {
-							if (v[i] < rc[j]) {
-								v[i] = j-1;
-								break;
-							}
-						}
-					}
+// lookup of "from - to - becomes" intervals. The interval boundaries are sorted, and each boundary 
+// and each interval between two consecutive boundaries gets the value of the first row of rcl that 
+// includes it, such that a value can be found with a binary search
+class IntervalLookup {
+	private:
+		std::vector<double> brks;
+		// 2*i for brks[i]; 2*i+1 for the values between brks[i] and brks[i+1]
+		std::vector<double> res;
+		std::vector<char> found;
+	public:
+		IntervalLookup() {}
+		IntervalLookup(const std::vector<double> &from, const std::vector<double> &to, const std::vector<double> &becomes, bool closedleft, bool closedright) {
+			for (size_t j=0; j<from.size(); j++) {
+				if (std::isnan(from[j]) || std::isnan(to[j])) continue;
+				brks.push_back(from[j]);
+				brks.push_back(to[j]);
+			}
+			std::sort(brks.begin(), brks.end());
+			brks.erase(std::unique(brks.begin(), brks.end()), brks.end());
+			res.resize(brks.size() * 2);
+			found.resize(brks.size() * 2, 0);
+			// the first row takes precedence, so it is done last
+			for (size_t jj=from.size(); jj>0; jj--) {
+				size_t j = jj-1;
+				if (std::isnan(from[j]) || std::isnan(to[j])) continue;
+				size_t a = std::lower_bound(brks.begin(), brks.end(), from[j]) - brks.begin();
+				size_t b = std::lower_bound(brks.begin(), brks.end(), to[j]) - brks.begin();
+				size_t start = closedleft ? 2*a : 2*a+1;
+				size_t end = closedright ? 2*b+1 : 2*b;
+				for (size_t k=start; k<end; k++) {
+					res[k] = becomes[j];
+					found[k] = 1;
 				}
 			}
 		}
+		bool find(const double &x, double &out) const {
+			size_t k = std::upper_bound(brks.begin(), brks.end(), x) - brks.begin();
+			if (k == 0) return false;
+			k--;
+			k = (brks[k] == x) ? 2*k : 2*k+1;
+			if (!found[k]) return false;
+			out = res[k];
+			return true;
+		}
+};
 
-	// "is - becomes"
-	} else if (nc == 2) {
 
+// the result of replacing from[0] with to[0], then from[1] with to[1], etc. 
+// combined into a single hash map (going backwards, each value maps to the final value)
+class ReplaceLookup {
+	private:
+		std::unordered_map<double, double> map;
 		bool hasNAN = false;
-		double replaceNAN = NAval;
-		for (size_t j=0; j<nr; j++) {
-			if (std::isnan(rcl[0][j])) {
-				hasNAN = true;
-				replaceNAN = rcl[1][j];
-			}
-		} 
-		for (size_t i=0; i<n; i++) {
-			if (std::isnan(v[i])) {
-				if (hasNAN) {
-					v[i] = replaceNAN;
+		double replaceNAN = NAN;
+	public:
+		ReplaceLookup(const std::vector<double> &from, const std::vector<double> &to) {
+			map.reserve(from.size());
+			for (size_t jj=from.size(); jj>0; jj--) {
+				size_t j = jj-1;
+				double d = to[j];
+				find(to[j], d);
+				if (std::isnan(from[j])) {
+					hasNAN = true;
+					replaceNAN = d;
 				} else {
-					v[i] = NAval;
-				}
-			} else {
-				bool found = false;
-				for (size_t j=0; j<nr; j++) {
-					if (v[i] == rcl[0][j]) {
-						v[i] = rcl[1][j];
-						found = true;
-						break;
-					}
-				}
-				if ((othNA) & (!found)) {
-					v[i] = NAval;
+					map[from[j]] = d;
 				}
 			}
 		}
-
-	// "from - to - becomes"
-	} else {
-	
-		bool hasNAN = false;
-		double replaceNAN = NAval;
-		for (size_t j=0; j<nr; j++) {
-			if (std::isnan(rcl[0][j]) || std::isnan(rcl[1][j])) {
-				hasNAN = true;
-				replaceNAN = rcl[2][j];
+		bool find(const double &x, double &out) {
+			if (std::isnan(x)) {
+				if (hasNAN) out = replaceNAN;
+				return hasNAN;
 			}
-		} 
-	
-		if (leftright) {   // interval closed at left and right
-
-			for (size_t i=0; i<n; i++) {
-				if (std::isnan(v[i])) {
-					if (hasNAN) {
-						v[i] = replaceNAN;
-					} else {
-						v[i] = NAval;
-					}
-				} else {
-					bool found = false;
-					for (size_t j=0; j<nr; j++) {
-						if ((v[i] >= rcl[0][j]) & (v[i] <= rcl[1][j])) {
-							v[i] = rcl[2][j];
-							found = true;
-							break;
-						}
-					}
-					if ((othNA) & (!found))  {
-						v[i] = NAval;
-					}			
-				}
+			auto it = map.find(x);
+			if (it == map.end()) return false;
+			out = it->second;
+			return true;
+		}
+		void replace(std::vector<double>::iterator first, std::vector<double>::iterator last) {
+			for (; first != last; first++) {
+				find(*first, *first);
 			}
-		} else if (right) {  // interval closed at right
-				if (lowest) {  // include lowest value (left) of interval
+		}
+};
 
-				double lowval = rcl[0][0];
-				double lowres = rcl[2][0];
-				for (size_t i=1; i<nr; i++) {
-					if (rcl[0][i] < lowval) {
-						lowval = rcl[0][i];
-						lowres = rcl[2][i];
-					}
-				}
 
-				for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						if (hasNAN) {
-							v[i] = replaceNAN;
-						} else {
-							v[i] = NAval;
-						}
-					} else if (v[i] == lowval) {
-						v[i] = lowres;
-					} else {
-						bool found = false;
-						for (size_t j=0; j<nr; j++) {
-							if ((v[i] > rcl[0][j]) & (v[i] <= rcl[1][j])) {
-								v[i] = rcl[2][j];
-								found = true;
-								break;
-							}
-						}
-						if  ((othNA) & (!found))  {
-							v[i] = NAval;
-						}
+// the lookup for a classification matrix, made once for all blocks (or for each layer, with 
+// bylayer) and then used for the values of each block with reclass
+class ReclassPlan {
+	private:
+		size_t nc;
+		bool right = false;
+		bool lowest;
+		bool othNA;
+		double NAval = NAN;
+		// "from - to" breaks 
+		std::vector<double> rc;
+		double rmin, rmax;
+		// NAN in "is" or "from - to"
+		bool hasNAN = false;
+		double replaceNAN = NAN;
+		// "is - becomes"
+		ValueTable<double> table;
+		// "from - to - becomes"
+		bool uselow = false;
+		double lowval = NAN;
+		double lowres = NAN;
+		IntervalLookup intervals;
+
+	public:
+		ReclassPlan(const std::vector<std::vector<double>> &rcl, unsigned doright, bool lowest, bool othNA) : lowest(lowest), othNA(othNA) {
+
+			nc = rcl.size(); // should be 1, 2 or 3
+			if (nc == 2) {
+				doright = 3; // should be 2?
+			}
+			bool leftright = false;
+			if (doright > 1) {
+				leftright = true;
+			} else if (doright) {
+				right = true;
+			}
+			size_t nr = rcl[0].size();
+
+			if (nc == 1) {
+				rc = rcl[0];
+				std::sort(rc.begin(), rc.end());
+				rmin = rc[0];
+				rmax = rc[nr-1];
+
+			} else if (nc == 2) {
+				for (size_t j=0; j<nr; j++) {
+					if (std::isnan(rcl[0][j])) {
+						hasNAN = true;
+						replaceNAN = rcl[1][j];
 					}
-				}
+				} 
+				table = ValueTable<double>(rcl[0], rcl[1]);
 
-			} else { // !dolowest
-					for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						if (hasNAN) {
-							v[i] = replaceNAN;
-						} else {
-							v[i] = NAval;
-						}
-					} else {
-						bool found = false;
-						for (size_t j=0; j<nr; j++) {
-							if ((v[i] > rcl[0][j]) & (v[i] <= rcl[1][j])) {
-								v[i] = rcl[2][j];
-								found = true;
-								break;
+			} else {
+				for (size_t j=0; j<nr; j++) {
+					if (std::isnan(rcl[0][j]) || std::isnan(rcl[1][j])) {
+						hasNAN = true;
+						replaceNAN = rcl[2][j];
+					}
+				} 
+				// with "lowest" the lowest value of the first interval (right) 
+				// or highest value of the last interval (!right) is included
+				if ((!leftright) && lowest) {
+					uselow = true;
+					if (right) {
+						lowval = rcl[0][0];
+						lowres = rcl[2][0];
+						for (size_t i=1; i<nr; i++) {
+							if (rcl[0][i] < lowval) {
+								lowval = rcl[0][i];
+								lowres = rcl[2][i];
 							}
 						}
-						if  ((othNA) & (!found))  {
-							v[i] = NAval;
+					} else { // which here means highest because right=FALSE
+						lowval = rcl[1][0];
+						lowres = rcl[2][0];
+						for (size_t i=0; i<nr; i++) {
+							if (rcl[1][i] > lowval) {
+								lowval = rcl[1][i];
+								lowres = rcl[2][i];
+							}
 						}
 					}
 				}
+				intervals = IntervalLookup(rcl[0], rcl[1], rcl[2], leftright || (!right), leftright || right);
 			}
+		}
 
-		} else { // !doright
-
-			if (lowest) { // which here means highest because right=FALSE
-
-				double lowval = rcl[1][0];
-				double lowres = rcl[2][0];
-				for (size_t i=0; i<nr; i++) {
-					if (rcl[1][i] > lowval) {
-						lowval = rcl[1][i];
-						lowres = rcl[2][i];
-					}
-				}
-
-				for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						if (hasNAN) {
-							v[i] = replaceNAN;
+		void reclass(std::vector<double>::iterator first, std::vector<double>::iterator last) const {
+			if (nc == 1) {
+				double nr = rc.size();
+				// the class is the position of the first break (after the first) that is larger than 
+				// (or equal to, if right) the value, minus one
+				if (right) {   // interval closed at left and right
+					for (; first != last; first++) {
+						double &x = *first;
+						if (std::isnan(x) || (x < rmin) || (x > rmax) || ((!lowest) && (x == rmin))) {
+							x = NAval;
 						} else {
-							v[i] = NAval;
-						}
-					} else if (v[i] == lowval) {
-						v[i] = lowres;
-					} else {
-						bool found = false;
-						for (size_t j=0; j<nr; j++) {
-							if ((v[i] >= rcl[0][j]) & (v[i] < rcl[1][j])) {
-								v[i] = rcl[2][j];
-								found = true;
-								break;
-							}
+							x = (std::lower_bound(rc.begin()+1, rc.end(), x) - rc.begin()) - 1;
 						}
-						if  ((othNA) & (!found))  {
-							v[i] = NAval;
+					}
+				} else {
+					for (; first != last; first++) {
+						double &x = *first;
+						if (std::isnan(x) || (x < rmin) || (x > rmax) || ((!lowest) && (x == rmax))) {
+							x = NAval;
+						} else if (x == rmax) {
+							// the last class
+							x = nr-2;
+						} else {
+							x = (std::upper_bound(rc.begin()+1, rc.end(), x) - rc.begin()) - 1;
 						}
 					}
 				}
 
-			} else { //!dolowest
+			} else if (nc == 2) {
+				double d;
+				for (; first != last; first++) {
+					double &x = *first;
+					if (std::isnan(x)) {
+						x = hasNAN ? replaceNAN : NAval;
+					} else if (table.find(x, d)) {
+						x = d;
+					} else if (othNA) {
+						x = NAval;
+					}
+				}
 
-				for (size_t i=0; i<n; i++) {
-					if (std::isnan(v[i])) {
-						if (hasNAN) {
-							v[i] = replaceNAN;
-						} else {
-							v[i] = NAval;
-						}
-					} else {
-						bool found = false;
-						for (size_t j=0; j<nr; j++) {
-							if ((v[i] >= rcl[0][j]) & (v[i] < rcl[1][j])) {
-								v[i] = rcl[2][j];
-								found = true;
-								break;
-							}
-						}
-						if  ((othNA) & (!found))  {
-							v[i] = NAval;
-						}
+			} else {
+				double d;
+				for (; first != last; first++) {
+					double &x = *first;
+					if (std::isnan(x)) {
+						x = hasNAN ? replaceNAN : NAval;
+					} else if (uselow && (x == lowval)) {
+						x = lowres;
+					} else if (intervals.find(x, d)) {
+						x = d;
+					} else if (othNA) {
+						x = NAval;
 					}
 				}
 			}
 		}
-	}
-}
+};
 
 
 SpatRaster SpatRaster::replaceValues(std::vector<double> from, std::vector<double> to, long nl, SpatOptions &opt) {
@@ -2948,6 +3214,13 @@ SpatRaster SpatRaster::replaceValues(std::vector<double> from, std::vector<doubl
 	if (multi) {
 		size_t tosz = to.size() / nl;
 		size_t nlyr = out.nlyr();
+		std::vector<ReplaceLookup> lookup;
+		lookup.reserve(nlyr);
+		for (size_t lyr = 0; lyr < nlyr; lyr++) {
+			std::vector<double> tolyr(to.begin()+lyr*tosz, to.begin()+(lyr+1)*tosz);
+			recycle(tolyr, from);
+			lookup.push_back(ReplaceLookup(from, tolyr));
+		}
 		for (size_t i = 0; i < out.bs.n; i++) {
 			std::vector<double> v = readBlock(out.bs, i);
 			size_t vs = v.size();
@@ -2956,32 +3229,17 @@ SpatRaster SpatRaster::replaceValues(std::vector<double> from, std::vector<doubl
 				v.insert(v.end(), v.begin(), v.begin()+vs);
 			}
 			for (size_t lyr = 0; lyr < nlyr; lyr++) {
-				std::vector<double> tolyr(to.begin()+lyr*tosz, to.begin()+(lyr+1)*tosz);
-				recycle(tolyr, from);
 				size_t offset = lyr*vs;
-				for (size_t j=0; j< from.size(); j++) {
-					if (std::isnan(from[j])) {
-						for (size_t k=offset; k<(offset+vs); k++) {
-							v[k] = std::isnan(v[k]) ? tolyr[j] : v[k];
-						}
-					} else {
-						std::replace(v.begin()+offset, v.begin()+(offset+vs), from[j], tolyr[j]);
-					}
-				}
+				lookup[lyr].replace(v.begin()+offset, v.begin()+(offset+vs));
 			}
 			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;	
 		}
 	} else {
 		recycle(to, from);
+		ReplaceLookup lookup(from, to);
 		for (size_t i = 0; i < out.bs.n; i++) {
 			std::vector<double> v = readBlock(out.bs, i);
-			for (size_t j=0; j< from.size(); j++) {
-				if (std::isnan(from[j])) {
-					for (double &d : v) d = std::isnan(d) ? to[j] : d;
-				} else {
-					std::replace(v.begin(), v.end(), from[j], to[j]);
-				}
-			}
+			lookup.replace(v.begin(), v.end());
 			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;	
 		}
 	}
@@ -2999,7 +3257,8 @@ SpatRaster SpatRaster::reclassify(std::vector<std::vector<double>> rcl, unsigned
 	size_t nr = rcl[0].size();
 	size_t nl = nlyr();
 	if (nl == 1) bylayer = false;
-	size_t maxnc = 3 + nl * bylayer;
+	// with bylayer, the "is" or "from - to" columns are followed by a "becomes" column for each layer
+	size_t maxnc = 3 + (nl-1) * bylayer;
 	size_t rcldim = nc;
 
 	if (bylayer) {
@@ -3072,26 +3331,27 @@ SpatRaster SpatRaster::reclassify(std::vector<std::vector<double>> rcl, unsigned
 	}
 	
 	if (bylayer) {
-		std::vector<std::vector<double>> lyrrcl(rcldim+1);
-		for (size_t i=0; i<rcldim; i++) {
-			lyrrcl[i] = rcl[i];
+		std::vector<ReclassPlan> plans;
+		plans.reserve(nl);
+		std::vector<std::vector<double>> lyrrcl(rcl.begin(), rcl.begin() + rcldim);
+		for (size_t lyr = 0; lyr < nl; lyr++) {
+			lyrrcl[rcldim-1] = rcl[rcldim-1+lyr];
+			plans.push_back(ReclassPlan(lyrrcl, right, lowest, othersNA));
 		}
 		for (size_t i = 0; i < out.bs.n; i++) {
-			unsigned off = bs.nrows[i] * ncol() ;
+			size_t off = out.bs.nrows[i] * ncol();
 			std::vector<double> v = readBlock(out.bs, i);
 			for (size_t lyr = 0; lyr < nl; lyr++) {
-				unsigned offset = lyr * off;
-				lyrrcl[rcldim] = rcl[rcldim+lyr];
-				std::vector<double> vx(v.begin()+offset, v.begin()+offset+off);
-				reclass_vector(vx, lyrrcl, right, lowest, othersNA);
-				std::copy(vx.begin(), vx.end(), v.begin()+offset);
+				size_t offset = lyr * off;
+				plans[lyr].reclass(v.begin()+offset, v.begin()+offset+off);
 			}
 			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;	
 		}
 	} else {
+		ReclassPlan plan(rcl, right, lowest, othersNA);
 		for (size_t i = 0; i < out.bs.n; i++) {
 			std::vector<double> v = readBlock(out.bs, i);
-			reclass_vector(v, rcl, right, lowest, othersNA);
+			plan.reclass(v.begin(), v.end());
 			if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol())) return out;	
 		}
 	}
@@ -3128,148 +3388,286 @@ SpatRaster SpatRaster::reclassify(std::vector<double> rcl, unsigned nc, unsigned
 
 
 
-std::vector<std::vector<double>> clump_getRCL(std::vector<std::vector<size_t>> rcl, size_t n) {
-	std::vector<std::vector<size_t>> rcl2(rcl[0].size());
-	for (size_t i=0; i<rcl[0].size(); i++) {
-		rcl2[i].push_back(rcl[0][i]);
-		rcl2[i].push_back(rcl[1][i]);
-	}
-    std::sort(rcl2.begin(), rcl2.end());
-    rcl2.erase(std::unique(rcl2.begin(), rcl2.end()), rcl2.end());
-	std::vector<std::vector<double>> out(2);
-	for (size_t i=0; i<rcl2.size(); i++) {
-		out[0].push_back(rcl2[i][1]);
-		out[1].push_back(rcl2[i][0]);
-	}
-	// from - to 
-	// 3 - 1
-	// 4 - 3
-    // becomes
-    // 3 - 1
-    // 4 - 1
-	for (size_t i=1; i<out[0].size(); i++) {
-		for (size_t j=0; j<i; j++) {
-			if (out[0][i] == out[1][j]) {
-				out[1][j] = out[0][i];
+// union-find (disjoint sets) of provisional patch labels. The root of a set is its 
+// lowest label, such that the final numbers are in order of first occurrence 
+class PatchLabels {
+	public:
+		std::vector<size_t> parent = {0};
+		std::vector<double> count = {0};
+
+		size_t add() {
+			size_t id = parent.size();
+			parent.push_back(id);
+			count.push_back(0);
+			return id;
+		}
+		size_t find(size_t i) {
+			while (parent[i] != i) {
+				parent[i] = parent[parent[i]]; // path halving
+				i = parent[i];
+			}
+			return i;
+		}
+		void unite(size_t a, size_t b) {
+			a = find(a);
+			b = find(b);
+			if (a < b) {
+				parent[b] = a;
+			} else if (b < a) {
+				parent[a] = b;
+			}
+		}
+		// consecutive patch numbers for all labels, and the number of cells of each patch
+		void compact(std::vector<double> &remap, std::vector<double> &sizes) {
+			size_t n = parent.size();
+			remap.resize(n, NAN);
+			sizes.resize(0);
+			for (size_t i=1; i<n; i++) {
+				size_t r = find(i);
+				if (r == i) {
+					sizes.push_back(0);
+					remap[i] = sizes.size();
+				} else {
+					remap[i] = remap[r];
+				}
+				sizes[remap[i]-1] += count[i];
 			}
 		}
-	}
+};
 
-	std::vector<double> lost = out[0];
-	lost.push_back(n);
-	size_t sub = 0;
-	for (size_t i=0; i<lost.size(); i++) {
-		sub++;
-		for (size_t j=lost[i]+1; j<lost[i+1]; j++) {
-			out[0].push_back(j);
-			out[1].push_back(j-sub);
-		}
-	}
-	return out;
-}
 
+// label the non-NA cells of a block with (provisional) patch labels. 
+// "above" has the labels of the last row of the previous block
+void label_patches(std::vector<double> &v, std::vector<double> &above, bool d8, const size_t &nr, const size_t &nc, PatchLabels &pl) {
 
-void clump_replace(std::vector<double> &v, size_t n, const std::vector<double>& d, size_t cstart, std::vector<std::vector<size_t>>& rcl) {
-	for (size_t i=0; i<n; i++) {
-		for (size_t j=1; j<d.size(); j++) {
-			if (v[i] == d[j]) {
-				v[i] = d[0];
+	for (size_t r=0; r<nr; r++) {
+		double *prev = (r == 0) ? &above[0] : &v[(r-1)*nc];
+		double *cur = &v[r*nc];
+		for (size_t c=0; c<nc; c++) {
+			if (std::isnan(cur[c])) continue;
+			size_t lab = 0;
+			double nb[4] = {prev[c], NAN, NAN, NAN};
+			if (c > 0) {
+				nb[1] = cur[c-1];
+				if (d8) nb[2] = prev[c-1];
 			}
+			if (d8 && (c < (nc-1))) {
+				nb[3] = prev[c+1];
+			}
+			for (size_t k=0; k<4; k++) {
+				if (std::isnan(nb[k])) continue;
+				if (lab == 0) {
+					lab = nb[k];
+				} else if (lab != nb[k]) {
+					pl.unite(lab, nb[k]);
+				}
+			}
+			if (lab == 0) {
+				lab = pl.add();
+			}
+			pl.count[lab]++;
+			cur[c] = lab;
 		}
 	}
-	if (d[0] < cstart) {
-		for (size_t j=1; j<d.size(); j++) {
-			rcl[0].push_back(d[0]);
-			rcl[1].push_back(d[j]);
-		}
-	}
+	size_t off = (nr-1) * nc;
+	above = std::vector<double>(v.begin()+off, v.end());
 }
 
 
-void clump_test(std::vector<double> &d) {
-	d.erase(std::remove_if(d.begin(), d.end(),
-		[](const double& v) { return std::isnan(v); }), d.end());
-	std::sort(d.begin(), d.end());
-	d.erase(std::unique(d.begin(), d.end()), d.end());
-}
 
-void broom_clumps(std::vector<double> &v, std::vector<double>& above, const size_t &dirs, size_t &ncps, const size_t &nr, const size_t &nc, std::vector<std::vector<size_t>> &rcl) {
+SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, bool addsize, SpatOptions &opt) {
 
-	size_t nstart = ncps;
+	SpatRaster out = geometry(1 + addsize);
+	if (nlyr() > 1) {
+		SpatOptions ops(opt);
+		std::string filename = opt.get_filename();
+		ops.set_filenames({""});
+		for (size_t i=0; i<nlyr(); i++) {
+			std::vector<unsigned> lyr = {(unsigned)i};
+			SpatRaster x = subset(lyr, ops);
+			x = x.clumps(directions, zeroAsNA, addsize, ops);
+			out.addSource(x);
+		}
+		if (filename != "") {
+			out = out.writeRaster(opt);
+		}
+		return out;
+	}
 
-	bool d4 = dirs == 4;
+	if (!(directions == 4 || directions == 8)) {
+		out.setError("directions must be 4 or 8");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("cannot compute clumps for a raster with no values");
+		return out;
+	}
+	std::string filename = opt.get_filename();
+	if (filename != "") {
+		bool overwrite = opt.get_overwrite();
+		std::string errmsg;
+		if (!can_write(filename, overwrite, errmsg)) {
+			out.setError(errmsg + " (" + filename +")");
+			return(out);
+		}
+	}
 
-	if ( !std::isnan(v[0]) ) { //first cell, no cell left of it
-		if (std::isnan(above[0])) {
-			v[0] = ncps;
-			ncps++;
-		} else {
-			v[0] = above[0];
+	// first pass: provisional labels, and the equivalence of labels 
+	// the labels can be larger than the number of cells that FLT4S can represent exactly
+	SpatRaster tmp = geometry(1);
+	SpatOptions topt(opt);
+	topt.set_filenames({""});
+	topt.set_datatype("FLT8S");
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+ 	if (!tmp.writeStart(topt)) { 
+		readStop();
+		out.setError(tmp.getError());
+		return out; 
+	}
+	size_t nc = ncol();
+	std::vector<double> above(nc, NAN);
+	PatchLabels pl;
+	for (size_t i = 0; i < tmp.bs.n; i++) {
+		std::vector<double> v = readBlock(tmp.bs, i);
+		if (zeroAsNA) {
+			std::replace(v.begin(), v.end(), 0.0, (double)NAN);
+		}
+		label_patches(v, above, directions == 8, tmp.bs.nrows[i], nc, pl);
+		if (!tmp.writeValues(v, tmp.bs.row[i], tmp.bs.nrows[i], 0, nc)) {
+			out.setError(tmp.getError());
+			return out;
 		}
 	}
+	tmp.writeStop();
+	readStop();
 
-	for (size_t i=1; i<nc; i++) { //first row, no row above it, use "above"
-		if (!std::isnan(v[i])) {
-			std::vector<double> d;
-			if (d4) {
-				d = {above[i], v[i-1]} ;
-			} else {
-				d = {above[i], above[i-1], v[i-1]} ;
-			}
-			clump_test(d);
-			if (d.size() > 0) {
-				v[i] = d[0];
-				if (d.size() > 1) {
-					clump_replace(v, i, d, nstart, rcl);
-				}
-			} else {
-				v[i] = ncps;
-				ncps++;
+	// second pass: final (consecutive) patch numbers with a lookup table
+	std::vector<double> remap, sizes;
+	pl.compact(remap, sizes);
+	if (!tmp.readStart()) {
+		out.setError(tmp.getError());
+		return(out);
+	}
+ 	if (!out.writeStart(opt)) { 
+		tmp.readStop();
+		return out; 
+	}
+	for (size_t i = 0; i < out.bs.n; i++) {
+		std::vector<double> v = tmp.readBlock(out.bs, i);
+		size_t n = v.size();
+		for (double &d : v) {
+			if (!std::isnan(d)) d = remap[(size_t)d];
+		}
+		if (addsize) {
+			v.resize(2 * n, NAN);
+			for (size_t j=0; j<n; j++) {
+				if (!std::isnan(v[j])) v[n+j] = sizes[v[j]-1];
 			}
 		}
+		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) return out;
+	}
+	out.writeStop();
+	tmp.readStop();
+	if (addsize) {
+		out.setNames({"patches", "ncells"});
 	}
+	return out;
+}
 
 
-	for (size_t r=1; r<nr; r++) { //other rows
-		size_t i=r*nc;
-		if (!std::isnan(v[i])) { // first cell
-			if (std::isnan(v[i-nc])) {
-				v[i] = ncps;
-				ncps++;
-			} else {
-				v[i] = v[i-nc];
+// label the non-NA cells of a block such that connected cells with the same value
+// have the same (provisional) label. "above" and "abovev" have the labels and the 
+// values of the last row of the previous block. "regval" gets the value of each new label
+void label_regions(std::vector<double> &v, std::vector<double> &lab, std::vector<double> &above, std::vector<double> &abovev, bool d8, const size_t &nr, const size_t &nc, PatchLabels &pl, std::vector<double> &regval) {
+
+	lab.resize(v.size());
+	for (size_t r=0; r<nr; r++) {
+		double *prev = (r == 0) ? &above[0] : &lab[(r-1)*nc];
+		double *prevv = (r == 0) ? &abovev[0] : &v[(r-1)*nc];
+		double *cur = &lab[r*nc];
+		double *curv = &v[r*nc];
+		for (size_t c=0; c<nc; c++) {
+			if (std::isnan(curv[c])) {
+				cur[c] = NAN;
+				continue;
+			}
+			double val = curv[c];
+			size_t k = 0;
+			double nb[4] = {NAN, NAN, NAN, NAN};
+			if (prevv[c] == val) nb[k++] = prev[c];
+			if (c > 0) {
+				if (curv[c-1] == val) nb[k++] = cur[c-1];
+				if (d8 && (prevv[c-1] == val)) nb[k++] = prev[c-1];
+			}
+			if (d8 && (c < (nc-1)) && (prevv[c+1] == val)) {
+				nb[k++] = prev[c+1];
+			}
+			size_t id = 0;
+			for (size_t j=0; j<k; j++) {
+				if (id == 0) {
+					id = nb[j];
+				} else if (id != nb[j]) {
+					pl.unite(id, nb[j]);
+				}
+			}
+			if (id == 0) {
+				id = pl.add();
+				regval.push_back(val);
 			}
+			pl.count[id]++;
+			cur[c] = id;
 		}
-		for (size_t i=r*nc+1; i<((r+1)*nc); i++) { // other cells
-			if (!std::isnan(v[i])) {
-				std::vector<double> d;
-				if (d4) {
-					d = {v[i-nc], v[i-1]} ;
-				} else {
-					d = {v[i-nc], v[i-nc-1], v[i-1]} ;
-				}
-				clump_test(d);
-				if (d.size() > 0) {
-					v[i] = d[0];
-					if (d.size() > 1) {
-						clump_replace(v, i, d, nstart, rcl);
-					}
-				} else {
-					v[i] = ncps;
-					ncps++;
+	}
+	size_t off = (nr-1) * nc;
+	above = std::vector<double>(lab.begin()+off, lab.end());
+	abovev = std::vector<double>(v.begin()+off, v.end());
+}
+
+
+// for each pair of adjacent cells that are in different regions, consider the larger 
+// region as the neighbour to merge with for a region that is too small 
+void sieve_neighbours(std::vector<double> &lab, std::vector<double> &above, bool d8, const size_t &nr, const size_t &nc, const std::vector<double> &remap, const std::vector<double> &sizes, const double &threshold, std::vector<double> &best) {
+
+	auto consider = [&](size_t a, size_t b) {
+		if ((sizes[a] < threshold) && ((std::isnan(best[a])) || (sizes[b] > sizes[best[a]]))) {
+			best[a] = b;
+		}
+	};
+	for (size_t r=0; r<nr; r++) {
+		double *prev = (r == 0) ? &above[0] : &lab[(r-1)*nc];
+		double *cur = &lab[r*nc];
+		for (size_t c=0; c<nc; c++) {
+			if (std::isnan(cur[c])) continue;
+			double nb[4] = {prev[c], NAN, NAN, NAN};
+			if (c > 0) {
+				nb[1] = cur[c-1];
+				if (d8) nb[2] = prev[c-1];
+			}
+			if (d8 && (c < (nc-1))) {
+				nb[3] = prev[c+1];
+			}
+			size_t a = remap[cur[c]] - 1;
+			for (size_t k=0; k<4; k++) {
+				if (std::isnan(nb[k])) continue;
+				size_t b = remap[nb[k]] - 1;
+				if (a != b) {
+					consider(a, b);
+					consider(b, a);
 				}
 			}
 		}
 	}
 	size_t off = (nr-1) * nc;
-	above = std::vector<double>(v.begin()+off, v.end());
+	above = std::vector<double>(lab.begin()+off, lab.end());
 }
 
 
+SpatRaster SpatRaster::sievefilter(int threshold, int directions, SpatOptions &opt) {
 
-SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
-
-	SpatRaster out = geometry(1);
+	SpatRaster out = geometry(1, true);
 	if (nlyr() > 1) {
 		SpatOptions ops(opt);
 		std::string filename = opt.get_filename();
@@ -3277,7 +3675,7 @@ SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
 		for (size_t i=0; i<nlyr(); i++) {
 			std::vector<unsigned> lyr = {(unsigned)i};
 			SpatRaster x = subset(lyr, ops);
-			x = x.clumps(directions, zeroAsNA, ops);
+			x = x.sievefilter(threshold, directions, ops);
 			out.addSource(x);
 		}
 		if (filename != "") {
@@ -3291,18 +3689,9 @@ SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
 		return out;
 	}
 	if (!hasValues()) {
-		out.setError("cannot compute clumps for a raster with no values");
+		out.setError("cannot sieve a raster with no values");
 		return out;
 	}
-
-	std::vector<size_t> dim = {nrow(), ncol()};
-
-	std::string tempfile = "";
-    std::vector<double> d, v, vv;
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
 	std::string filename = opt.get_filename();
 	if (filename != "") {
 		bool overwrite = opt.get_overwrite();
@@ -3312,31 +3701,206 @@ SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
 			return(out);
 		}
 	}
-
-	opt.set_filenames({""});
- 	if (!out.writeStart(opt)) { return out; }
+	bool d8 = directions == 8;
 	size_t nc = ncol();
-	size_t ncps = 1;
-	std::vector<double> above(nc, NAN);
-	std::vector<std::vector<size_t>> rcl(2);
+
+	// first pass: provisional labels of the regions with the same value
+	// (as FLT8S; the number of regions can be larger than FLT4S can represent exactly)
+	SpatRaster tmp = geometry(1);
+	SpatOptions topt(opt);
+	topt.set_filenames({""});
+	topt.set_datatype("FLT8S");
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+ 	if (!tmp.writeStart(topt)) { 
+		readStop();
+		out.setError(tmp.getError());
+		return out; 
+	}
+	std::vector<double> above(nc, NAN), abovev(nc, NAN);
+	std::vector<double> regval = {NAN};
+	PatchLabels pl;
+	for (size_t i = 0; i < tmp.bs.n; i++) {
+		std::vector<double> v = readBlock(tmp.bs, i);
+		std::vector<double> lab;
+		label_regions(v, lab, above, abovev, d8, tmp.bs.nrows[i], nc, pl, regval);
+		if (!tmp.writeValues(lab, tmp.bs.row[i], tmp.bs.nrows[i], 0, nc)) {
+			out.setError(tmp.getError());
+			return out;
+		}
+	}
+	tmp.writeStop();
+	readStop();
+
+	std::vector<double> remap, sizes;
+	pl.compact(remap, sizes);
+	size_t nreg = sizes.size();
+	std::vector<double> value(nreg);
+	for (size_t i=1; i<remap.size(); i++) {
+		value[remap[i]-1] = regval[i];
+	}
+
+	// second pass: the largest neighbour of each region that is too small
+	std::vector<double> best(nreg, NAN);
+	if (!tmp.readStart()) {
+		out.setError(tmp.getError());
+		return(out);
+	}
+	above = std::vector<double>(nc, NAN);
+	for (size_t i = 0; i < tmp.bs.n; i++) {
+		std::vector<double> lab = tmp.readBlock(tmp.bs, i);
+		sieve_neighbours(lab, above, d8, tmp.bs.nrows[i], nc, remap, sizes, threshold, best);
+	}
+
+	// a small region gets the value of the region it is merged with. That region
+	// may itself be merged; follow the chain while the regions get larger
+	std::vector<double> newval(nreg, NAN);
+	std::vector<size_t> path;
+	for (size_t i=0; i<nreg; i++) {
+		size_t j = i;
+		while (std::isnan(newval[j]) && (sizes[j] < threshold) && (!std::isnan(best[j]))) {
+			size_t b = best[j];
+			if ((sizes[b] < sizes[j]) || ((sizes[b] == sizes[j]) && (b > j))) break;
+			path.push_back(j);
+			j = b;
+		}
+		double v = std::isnan(newval[j]) ? value[j] : newval[j];
+		newval[j] = v;
+		for (size_t k=0; k<path.size(); k++) {
+			newval[path[k]] = v;
+		}
+		path.resize(0);
+	}
+
+	// third pass: write the values 
+ 	if (!out.writeStart(opt)) { 
+		tmp.readStop();
+		return out; 
+	}
 	for (size_t i = 0; i < out.bs.n; i++) {
-        v = readBlock(out.bs, i);
-		if (zeroAsNA) {
-			std::replace(v.begin(), v.end(), 0.0, (double)NAN);
+		std::vector<double> v = tmp.readBlock(out.bs, i);
+		for (double &d : v) {
+			if (!std::isnan(d)) d = newval[remap[d]-1];
 		}
-        broom_clumps(v, above, directions, ncps, out.bs.nrows[i], nc, rcl);
 		if (!out.writeValues(v, out.bs.row[i], out.bs.nrows[i], 0, nc)) return out;
 	}
 	out.writeStop();
-	readStop();
+	tmp.readStop();
+	return out;
+}
+
+
+SpatRaster SpatRaster::majorityfilter(int directions, bool half, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1, true);
+	if (nlyr() > 1) {
+		SpatOptions ops(opt);
+		std::string filename = opt.get_filename();
+		ops.set_filenames({""});
+		for (size_t i=0; i<nlyr(); i++) {
+			std::vector<unsigned> lyr = {(unsigned)i};
+			SpatRaster x = subset(lyr, ops);
+			x = x.majorityfilter(directions, half, ops);
+			out.addSource(x);
+		}
+		if (filename != "") {
+			out = out.writeRaster(opt);
+		}
+		return out;
+	}
+
+	if (!(directions == 4 || directions == 8)) {
+		out.setError("directions must be 4 or 8");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+ 	if (!out.writeStart(opt)) { 
+		readStop();
+		return out; 
+	}
+
+	size_t nc = ncol();
+	size_t nr = nrow();
+	std::vector<int> dr, dc;
+	if (directions == 4) {
+		dr = {-1, 0, 0, 1};
+		dc = { 0,-1, 1, 0};
+	} else {
+		dr = {-1,-1,-1, 0, 0, 1, 1, 1};
+		dc = {-1, 0, 1,-1, 1,-1, 0, 1};
+	}
+	size_t nd = dr.size();
+	std::vector<double> nb(nd);
+	std::vector<size_t> cnt(nd);
 
-	opt.set_filenames({filename});
-	if (rcl[0].size() > 0) {
-		std::vector<std::vector<double>> rc = clump_getRCL(rcl, ncps);
-		out = out.reclassify(rc, 3, true, false, false, opt);
-	} else if (filename != "") {
-		out = out.writeRaster(opt);
+	for (size_t i = 0; i < out.bs.n; i++) {
+		// one extra row above and below the block
+		size_t row = out.bs.row[i];
+		size_t nrows = out.bs.nrows[i];
+		size_t start = (row > 0) ? row - 1 : 0;
+		size_t end = std::min(nr, row + nrows + 1);
+		std::vector<double> v = readValues(start, end - start, 0, nc);
+		size_t off = row - start;
+		std::vector<double> x(v.begin() + off * nc, v.begin() + (off + nrows) * nc);
+
+		for (size_t r=0; r<nrows; r++) {
+			long vr = r + off;
+			long ar = r + row;
+			for (size_t c=0; c<nc; c++) {
+				double val = v[vr*nc+c];
+				if (std::isnan(val)) continue;
+				// the number of neighbours in the raster, and their distinct values with counts
+				size_t n = 0, k = 0;
+				for (size_t j=0; j<nd; j++) {
+					long rr = ar + dr[j];
+					long cc = c + dc[j];
+					if ((rr < 0) || (rr >= (long)nr) || (cc < 0) || (cc >= (long)nc)) continue;
+					n++;
+					double w = v[(vr+dr[j])*nc + cc];
+					if (std::isnan(w)) continue;
+					size_t m = 0;
+					for (; m<k; m++) {
+						if (nb[m] == w) {
+							cnt[m]++;
+							break;
+						}
+					}
+					if (m == k) {
+						nb[k] = w;
+						cnt[k] = 1;
+						k++;
+					}
+				}
+				if (k == 0) continue;
+				size_t mx = 0;
+				bool tie = false;
+				for (size_t m=1; m<k; m++) {
+					if (cnt[m] > cnt[mx]) {
+						mx = m;
+						tie = false;
+					} else if (cnt[m] == cnt[mx]) {
+						tie = true;
+					}
+				}
+				if (tie) continue;
+				if (half ? (2 * cnt[mx] >= n) : (2 * cnt[mx] > n)) {
+					x[r*nc+c] = nb[mx];
+				}
+			}
+		}
+		if (!out.writeValues(x, row, nrows, 0, nc)) return out;
 	}
+	out.writeStop();
+	readStop();
 	return out;
 }
 
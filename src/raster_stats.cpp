@@ -21,6 +21,7 @@
 #include <cmath>
 #include <algorithm>
 #include <map>
+#include <numeric>
 
 #include "vecmath.h"
 #include "math_utils.h"
@@ -548,3 +549,123 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 
 
 
+
+
+
+// zonal statistics for polygons. The cells of each polygon are summarized while they are
+// read, one window (of at most a block of rows) at a time; cell values are not collected.
+// The polygons are processed from top to bottom such that the file is read sequentially
+SpatDataFrame SpatRaster::zonal_vector(SpatVector p, std::string fun, bool weights, bool touches, bool narm, SpatOptions &opt) {
+
+	SpatDataFrame out;
+	std::vector<std::string> f {"sum", "mean", "min", "max", "count"};
+	if (std::find(f.begin(), f.end(), fun) == f.end()) {
+		out.setError("not a valid function");
+		return(out);
+	}
+	if (!hasValues()) {
+		out.setError("SpatRaster has no values");
+		return(out);
+	}
+	if (p.type() != "polygons") {
+		out.setError("SpatVector must have polygons");
+		return(out);
+	}
+
+	size_t nl = nlyr();
+	size_t ng = p.size();
+	size_t nc = ncol();
+	double posinf = std::numeric_limits<double>::infinity();
+	double neginf = -posinf;
+	std::vector<std::vector<double>> stats(nl, std::vector<double>(ng, NAN));
+
+	std::vector<size_t> ord(ng);
+	std::iota(ord.begin(), ord.end(), 0);
+	std::sort(ord.begin(), ord.end(), [&p](size_t a, size_t b) { return p.geoms[a].extent.ymax > p.geoms[b].extent.ymax; });
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	// maximum number of rows to read at once
+	BlockSize bs = getBlockSize(opt);
+	size_t maxrows = std::max(bs.nrows[0], (size_t)1);
+
+	for (size_t k=0; k<ng; k++) {
+		size_t i = ord[k];
+		std::vector<double> cells, wgt;
+		if (weights || touches) {
+			polygon_cells_exact(p.geoms[i], cells, wgt);
+			if (!weights) {
+				std::fill(wgt.begin(), wgt.end(), 1.0);
+			}
+		} else {
+			cells = polygon_cells(p.geoms[i]);
+			wgt.resize(cells.size(), 1.0);
+		}
+
+		std::vector<double> sumv(nl, 0), sumw(nl, 0), minv(nl, posinf), maxv(nl, neginf);
+		std::vector<bool> hasna(nl, false);
+		size_t j = 0;
+		size_t n = cells.size();
+		while (j < n) {
+			// window: all cells in the next maxrows rows
+			size_t row1 = cells[j] / nc;
+			size_t row2 = std::min(row1 + maxrows, nrow());
+			size_t col1 = nc;
+			size_t col2 = 0;
+			size_t jend = j;
+			while ((jend < n) && ((size_t)(cells[jend] / nc) < row2)) {
+				size_t col = (size_t)cells[jend] % nc;
+				col1 = std::min(col1, col);
+				col2 = std::max(col2, col);
+				jend++;
+			}
+			row2 = (size_t) cells[jend-1] / nc + 1;
+			size_t nr = row2 - row1;
+			size_t ncw = col2 - col1 + 1;
+			std::vector<double> v = readValues(row1, nr, col1, ncw);
+			size_t off = nr * ncw;
+			for (; j<jend; j++) {
+				size_t cell = (size_t)cells[j];
+				size_t idx = (cell / nc - row1) * ncw + (cell % nc - col1);
+				double w = wgt[j];
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					double d = v[lyr * off + idx];
+					if (std::isnan(d)) {
+						hasna[lyr] = true;
+						continue;
+					}
+					sumv[lyr] += d * w;
+					sumw[lyr] += w;
+					minv[lyr] = std::min(minv[lyr], d);
+					maxv[lyr] = std::max(maxv[lyr], d);
+				}
+			}
+		}
+
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			if (fun == "count") {
+				stats[lyr][i] = sumw[lyr];
+				continue;
+			}
+			if (hasna[lyr] && (!narm)) continue;
+			if (fun == "sum") {
+				stats[lyr][i] = sumv[lyr];
+			} else if (fun == "mean") {
+				if (sumw[lyr] > 0) stats[lyr][i] = sumv[lyr] / sumw[lyr];
+			} else if (fun == "min") {
+				if (minv[lyr] != posinf) stats[lyr][i] = minv[lyr];
+			} else {
+				if (maxv[lyr] != neginf) stats[lyr][i] = maxv[lyr];
+			}
+		}
+	}
+	readStop();
+
+	std::vector<std::string> nms = getNames();
+	for (size_t i=0; i<nl; i++) {
+		out.add_column(stats[i], nms[i]);
+	}
+	return(out);
+}
@@ -9,6 +9,7 @@
 #include "spatFactor.h"
 #include "recycle.h"
 #include "gdalio.h"
+#include "spatIndex.h"
 
 SpatRaster rasterizePoints(SpatVector p, SpatRaster r, std::vector<double> values, double background, SpatOptions &opt) {
 	r.setError("not implemented in C++ yet");
@@ -117,7 +118,7 @@ SpatRaster SpatRaster::rasterizeLyr(SpatVector x, double value, double backgroun
 		out = geometry(1);
 	}
 
-	GDALDataset *vecDS = x.write_ogr("", "lyr", "Memory", true);
+	GDALDataset *vecDS = x.write_ogr("", "lyr", "Memory", false, true);
 	if (x.hasError()) {
 		out.setError(x.getError());
 		return out;
@@ -187,6 +188,117 @@ SpatRaster SpatRaster::rasterizeLyr(SpatVector x, double value, double backgroun
 }
 
 
+// scanline rasterization of polygons, for one block of rows at a time. Only the 
+// polygons with an extent that overlaps with a block are considered (found with 
+// a spatial index). fun is one of "last", "sum", "count", "min", "max", "mean" or 
+// "cover" (the fraction of a cell that is covered). With weights=true, cells that 
+// are partly covered are included, with the covered fraction as weight. 
+// names and labels (categories) are set on the output if they are not empty
+SpatRaster SpatRaster::rasterizePolygons(SpatVector &x, std::vector<double> values, std::string fun, double background, bool weights, std::vector<std::string> names, std::vector<std::string> labels, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	if (!names.empty()) {
+		out.setNames(names);
+	}
+	if (!labels.empty()) {
+		out.setLabels(0, labels);
+	}
+	std::vector<std::string> funs = {"last", "sum", "count", "min", "max", "mean", "cover"};
+	if (std::find(funs.begin(), funs.end(), fun) == funs.end()) {
+		out.setError("unknown function: " + fun);
+		return out;
+	}
+	if (x.type() != "polygons") {
+		out.setError("rasterizePolygons only works for polygons");
+		return out;
+	}
+	size_t ng = x.size();
+	if (values.size() != ng) {
+		recycle(values, ng);
+	}
+	if (fun == "cover") weights = true;
+
+	std::vector<SpatExtent> ext(ng);
+	for (size_t i=0; i<ng; i++) {
+		ext[i] = x.geoms[i].extent;
+	}
+	SpatIndex index(ext);
+	// the sorted edges of the polygons that also overlap with the next block
+	std::vector<std::vector<std::vector<ScanEdge>>> edges(ng);
+
+	if (!out.writeStart(opt)) {
+		return out;
+	}
+	size_t nc = ncol();
+	SpatExtent e = getExtent();
+	double ry = yres();
+	std::vector<double> cells, wgt;
+	for (size_t i = 0; i < out.bs.n; i++) {
+		size_t row = out.bs.row[i];
+		size_t nrows = out.bs.nrows[i];
+		size_t off = row * nc;
+		std::vector<double> v(nrows * nc, NAN);
+		// the sum of the weights, or the number of polygons
+		std::vector<double> w(nrows * nc, 0);
+
+		SpatExtent be(e.xmin, e.xmax, e.ymax - (row + nrows) * ry, e.ymax - row * ry);
+		std::vector<size_t> gi = index.query(be);
+		for (size_t j=0; j<gi.size(); j++) {
+			size_t g = gi[j];
+			if (weights) {
+				polygon_cells_exact(x.geoms[g], edges[g], cells, wgt, row, row + nrows - 1);
+			} else {
+				cells = polygon_cells(x.geoms[g], edges[g], row, row + nrows - 1);
+				wgt.resize(0);
+				wgt.resize(cells.size(), 1);
+			}
+			if (x.geoms[g].extent.ymin >= be.ymin) {
+				std::vector<std::vector<ScanEdge>>().swap(edges[g]);
+			}
+			double val = values[g];
+			bool isna = std::isnan(val);
+			for (size_t k=0; k<cells.size(); k++) {
+				size_t c = cells[k] - off;
+				double f = wgt[k];
+				if (fun == "last") {
+					v[c] = val;
+					w[c] = 1;
+				} else if (fun == "cover") {
+					w[c] += f;
+				} else if (fun == "count") {
+					w[c] += f;
+				} else if (!isna) {
+					if (fun == "sum") {
+						v[c] = std::isnan(v[c]) ? val * f : v[c] + val * f;
+					} else if (fun == "mean") {
+						v[c] = std::isnan(v[c]) ? val * f : v[c] + val * f;
+					} else if (fun == "min") {
+						v[c] = std::isnan(v[c]) ? val : std::min(v[c], val);
+					} else if (fun == "max") {
+						v[c] = std::isnan(v[c]) ? val : std::max(v[c], val);
+					}
+					w[c] += f;
+				}
+			}
+		}
+		for (size_t j=0; j<v.size(); j++) {
+			if (w[j] == 0) {
+				v[j] = background;
+			} else if (fun == "cover") {
+				v[j] = std::min(w[j], 1.0);
+			} else if (fun == "count") {
+				v[j] = w[j];
+			} else if (fun == "mean") {
+				v[j] /= w[j];
+			}
+		}
+		if (!out.writeValues(v, row, nrows, 0, nc)) return out;
+	}
+	out.writeStop();
+	return out;
+}
+
+
 SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<double> values, 
 	double background, bool touches, bool add, bool weights, bool update, bool minmax, SpatOptions &opt) {
 
@@ -195,18 +307,8 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 	if (weights) update = false;
 	
 	if (weights && ispol) {
-		SpatOptions sopts(opt);
-		SpatRaster wout = geometry(1);
-		unsigned agx = 1000 / ncol();
-		agx = std::max((unsigned)10, agx); 
-		unsigned agy = 1000 / nrow();
-		agy = std::max((unsigned)10, agy);
-		wout = wout.disaggregate({agx, agy}, sopts);
-		field = "";
-		double f = agx * agy;
-		wout = wout.rasterize(x, field, {1/f}, background, touches, add, false, false, false, sopts);
-		wout = wout.aggregate({agx, agy}, "sum", true, opt);
-		return wout;
+		std::string fun = add ? "sum" : "cover";
+		return rasterizePolygons(x, {1}, fun, background, true, {}, {}, opt);
 	}
 
 	SpatRaster out;
@@ -223,6 +325,7 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 		out.addWarning("you cannot use add and touches at the same time");
 	}
 
+	std::vector<std::string> labels;
 	if (field != "") {
 		int i = x.df.get_fieldindex(field);
 		if (i < 0) {
@@ -240,6 +343,7 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 			}
 			if (!add && !update) {
 				out.setLabels(0, f.labels);
+				labels = f.labels;
 			}
 			if (add) {
 				add = false;
@@ -260,7 +364,14 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 		recycle(values, nGeoms);
 	}
 
-	GDALDataset *vecDS = x.write_ogr("", "lyr", "Memory", true);
+	if (ispol && (!touches) && (!update)) {
+		// native scanline rasterization, without copying the polygons to GDAL
+		if (add) background = 0;
+		std::string fun = add ? "sum" : "last";
+		return rasterizePolygons(x, values, fun, background, false, {field}, labels, opt);
+	}
+
+	GDALDataset *vecDS = x.write_ogr("", "lyr", "Memory", false, true);
 	if (x.hasError()) {
 		out.setError(x.getError());
 		return out;
@@ -389,6 +500,32 @@ std::vector<double> SpatRaster::rasterizeCells(SpatVector &v, bool touches) {
 		std::vector<double> out(1, NAN);
 		return out;
 	}
+
+	if (v.type() == "polygons") {
+		std::vector<double> cells, weights;
+		for (size_t i=0; i<v.size(); i++) {
+			std::vector<double> gcells;
+			if (touches) {
+				polygon_cells_exact(v.geoms[i], gcells, weights);
+			} else {
+				gcells = polygon_cells(v.geoms[i]);
+			}
+			cells.insert(cells.end(), gcells.begin(), gcells.end());
+		}
+		if (cells.size() == 0) {
+			// polygons smaller than a cell
+			SpatVector pts = v.as_points(false, true);
+			SpatDataFrame vd = pts.getGeometryDF();
+			std::vector<double> x = vd.getD(0);
+			std::vector<double> y = vd.getD(1);
+			cells = r.cellFromXY(x, y);
+			cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+			if (cells.size() == 0) {
+				cells.resize(1, NAN);
+			}
+		}
+		return cells;
+	}
 	
 	SpatRaster rc = r.crop(e, "out", opt);
 	std::vector<double> feats(1, 1) ;		
@@ -414,123 +551,23 @@ std::vector<double> SpatRaster::rasterizeCells(SpatVector &v, bool touches) {
 	return cells;
 }
 
-void SpatRaster::rasterizeCellsWeights(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v) { 
+void SpatRaster::rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v) { 
 // note that this is only for polygons
-    SpatOptions opt;
-	opt.progress = nrow()+1;
-	SpatRaster rr = geometry(1);
-	std::vector<unsigned> fact = {10, 10};
-	SpatExtent e = getExtent();
-	SpatExtent ve = v.getExtent();
-	e.intersect(ve);
-	if ( !e.valid() ) {
-		return;
-	}
-	SpatRaster r = rr.crop(v.extent, "out", opt);
-	r = r.disaggregate(fact, opt);
-	std::vector<double> feats(1, 1) ;	
-	r = r.rasterize(v, "", feats, NAN, true, false, false, false, false, opt); 
-	r = r.arith(100.0, "/", false, opt);
-	r = r.aggregate(fact, "sum", true, opt);
-	SpatVector pts = r.as_points(true, true, opt);
-	if (pts.size() == 0) {
+	cells.resize(0);
+	weights.resize(0);
+	for (size_t i=0; i<v.size(); i++) {
+		std::vector<double> gcells, gweights;
+		polygon_cells_exact(v.geoms[i], gcells, gweights);
+		cells.insert(cells.end(), gcells.begin(), gcells.end());
+		weights.insert(weights.end(), gweights.begin(), gweights.end());
+	}
+	if (cells.size() == 0) {
 		weights.resize(1);
-		weights[0] = NAN;
+		weights[0] = NAN;			
 		cells.resize(1);
 		cells[0] = NAN;
-	} else {
-		SpatDataFrame vd = pts.getGeometryDF();
-		std::vector<double> x = vd.getD(0);
-		std::vector<double> y = vd.getD(1);
-		cells = rr.cellFromXY(x, y);
-		weights = pts.df.dv[0];
 	}
-	return;
 }
 
-void SpatRaster::rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v) { 
-    
-	SpatOptions opt;
-	opt.progress = nrow()+1;
-	SpatRaster r = geometry(1);
-	r = r.crop(v.extent, "out", opt);
-
-//	if (r.ncell() < 1000) {
-		std::vector<double> feats(1, 1) ;	
-		r = r.rasterize(v, "", feats, NAN, true, false, false, false, false, opt); 
-
-		SpatVector pts = r.as_points(true, true, opt);
-		if (pts.size() == 0) {
-			weights.resize(1);
-			weights[0] = NAN;			
-			cells.resize(1);
-			cells[0] = NAN;
-		} else {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			cells = cellFromXY(x, y);
-
-			SpatVector rv = r.as_polygons(false, false, false, true, opt);
-			std::vector<double> csize = rv.area("m", true, {});
-			rv.df.add_column(csize, "area");
-			rv.df.add_column(cells, "cells");
-			rv = rv.crop(v);
-			weights = rv.area("m", true, {});
-			for (size_t i=0; i<weights.size(); i++) {
-				weights[i] /= rv.df.dv[0][i];
-			}
-			cells = rv.df.dv[1];
-		}
-//	}
-
-/*
-// the below would need to remove all cells already included in the above
-// because touches=false includes partly overlapped cells [#346]
-
-	else {
-		std::vector<double> feats(1, 1) ;	
-		SpatVector vv = v.as_lines();
-		SpatRaster b = r.rasterize(vv, "", feats, NAN, true, false, false, false, false, opt); 
-		SpatVector pts = b.as_points(true, true, opt);
-		if (pts.nrow() > 0) {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			cells = cellFromXY(x, y);
-			
-			SpatVector bv = b.as_polygons(false, false, false, true, opt);
-			std::vector<double> csize = bv.area("m", true, {});
-			bv.df.add_column(csize, "cellsize");
-			bv.df.add_column(cells, "cellnr");
-			bv = bv.crop(v);
-			weights = bv.area("m", true, {});
-			for (size_t i=0; i<weights.size(); i++) {
-				weights[i] /= bv.df.dv[0][i];
-			}
-			cells = bv.df.dv[1];
-		}
-		// touches = false
-		r = r.rasterize(v, "", feats, NAN, false, false, false, false, false, opt); 
-		pts = r.as_points(true, true, opt);
-		if (pts.nrow() > 0) {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			std::vector<double> cells2 = cellFromXY(x, y);
-			cells.insert(cells.end(), cells2.begin(), cells2.end());
-			weights.resize(weights.size() + cells2.size(), 1);	
-		}
-		
-		if (cells.size() == 0) {
-			weights.resize(1);
-			weights[0] = NAN;			
-			cells.resize(1);
-			cells[0] = NAN;
-		}
-	}
-*/	
-	
-}
 
 
@@ -29,6 +29,7 @@
 #include "spatTime.h"
 #include "recycle.h"
 #include "gdalio.h"
+#include "blockcache.h"
 
 //#include "NA.h"
 
@@ -708,6 +709,52 @@ void vflip(std::vector<double> &v, const size_t &ncell, const size_t &nrows, con
 }
 
 
+// a block of a band (1-based), from the cache, or read from the file and added to the cache
+std::shared_ptr<const std::vector<double>> cached_block(GDALDataset *poDataset, const std::string &filename, int band, int_64 bc, int_64 br, int bx, int by, CPLErr &err) {
+	std::string key = blockcache().key(filename, band, bc, br);
+	std::shared_ptr<const std::vector<double>> b = blockcache().get(key);
+	if (b != NULL) return b;
+	size_t bw = std::min((int_64)bx, poDataset->GetRasterXSize() - bc * bx);
+	size_t bh = std::min((int_64)by, poDataset->GetRasterYSize() - br * by);
+	std::vector<double> v(bw * bh);
+	GDALRasterBand *poBand = poDataset->GetRasterBand(band);
+	err = poBand->RasterIO(GF_Read, bc * bx, br * by, bw, bh, &v[0], bw, bh, GDT_Float64, 0, 0);
+	if (err != CE_None) return NULL;
+	return blockcache().put(key, v);
+}
+
+
+// read a window (band sequential) from cached blocks
+CPLErr read_cached(GDALDataset *poDataset, const std::string &filename, const std::vector<int> &bands, size_t row, size_t nrows, size_t col, size_t ncols, std::vector<double> &out) {
+	int bx, by;
+	poDataset->GetRasterBand(bands[0])->GetBlockSize(&bx, &by);
+	if (bx < 1) bx = poDataset->GetRasterXSize();
+	if (by < 1) by = 1;
+	size_t ncell = nrows * ncols;
+	CPLErr err = CE_None;
+	for (size_t i=0; i<bands.size(); i++) {
+		size_t off = i * ncell;
+		for (size_t br = row / by; br <= (row + nrows - 1) / by; br++) {
+			for (size_t bc = col / bx; bc <= (col + ncols - 1) / bx; bc++) {
+				std::shared_ptr<const std::vector<double>> b = cached_block(poDataset, filename, bands[i], bc, br, bx, by, err);
+				if (err != CE_None) return err;
+				size_t bw = std::min((size_t)bx, poDataset->GetRasterXSize() - bc * bx);
+				// overlap of the block and the window
+				size_t r1 = std::max(row, br * by);
+				size_t r2 = std::min(row + nrows, (br + 1) * by);
+				size_t c1 = std::max(col, bc * bx);
+				size_t c2 = std::min(col + ncols, (bc + 1) * bx);
+				for (size_t r=r1; r<r2; r++) {
+					const double *src = &(*b)[(r - br * by) * bw + (c1 - bc * bx)];
+					std::copy(src, src + (c2 - c1), out.begin() + off + (r - row) * ncols + (c1 - col));
+				}
+			}
+		}
+	}
+	return err;
+}
+
+
 void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols) {
 
 	if (source[src].multidim) {
@@ -746,7 +793,13 @@ void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t r
 		}
 	}
 
-	if (panBandMap.size() > 0) {
+	if (blockcache().enabled()) {
+		std::vector<int> bands(nl);
+		for (size_t i=0; i < nl; i++) {
+			bands[i] = source[src].layers[i]+1;
+		}
+		err = read_cached(source[src].gdalconnection, source[src].filename, bands, row, nrows, col, ncols, out);
+	} else if (panBandMap.size() > 0) {
 		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
 	} else {
 		err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, GDT_Float64, nl, NULL, 0, 0, 0, NULL);	
@@ -947,73 +1000,97 @@ std::vector<double> SpatRaster::readGDALsample(unsigned src, size_t srows, size_
 
 
 
-std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
-
-	std::vector<std::vector<double>> errout;
-	if (source[src].rotated) {
-		setError("cannot read from rotated files. First use 'rectify'");
-		return errout;
-	}
-
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
-
-	GDALRasterBand *poBand;
-	
-    if( poDataset == NULL )  {
-		return errout;
-	}
+// read the values of cells (rows, cols) grouped by the internal blocks of the file, such
+// that each block is read once, rather than one RasterIO call for each cell. Cells that are 
+// requested more than once (e.g. for bilinear interpolation) use the same read. 
+// The values are returned in the input order, cell by cell (n * nl)
+CPLErr read_rowcol_blocks(GDALDataset *poDataset, const std::string &filename, std::vector<int> &panBandMap, unsigned nl, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out) {
 
-	std::vector<unsigned> lyrs = source[src].layers;
-	unsigned nl = lyrs.size();
-	unsigned n = rows.size();
+	size_t n = rows.size();
+	int_64 nr = poDataset->GetRasterYSize();
+	int_64 nc = poDataset->GetRasterXSize();
+	int bx, by;
+	GDALRasterBand *poBand = poDataset->GetRasterBand(panBandMap.size() > 0 ? panBandMap[0] : 1);
+	poBand->GetBlockSize(&bx, &by);
+	if (bx < 1) bx = nc;
+	if (by < 1) by = 1;
+	int_64 nbx = (nc + bx - 1) / bx;
 
-	size_t fnr = nrow() - 1;
-	if (source[src].flipped) {
-		for (size_t i=0; i<n; i++) {
-			rows[i] = fnr - rows[i];
-		}
+	std::vector<std::pair<int_64, size_t>> blocks;
+	blocks.reserve(n);
+	for (size_t i=0; i<n; i++) {
+		if ((rows[i] < 0) || (cols[i] < 0) || (rows[i] >= nr) || (cols[i] >= nc)) continue;
+		blocks.push_back({(rows[i] / by) * nbx + cols[i] / bx, i});
 	}
+	std::sort(blocks.begin(), blocks.end());
 
-	std::vector<int> panBandMap;
-	if (!source[src].in_order()) {
-		panBandMap.reserve(nl);
-		for (size_t i=0; i < nl; i++) {
-			panBandMap.push_back(lyrs[i]+1);
-		}
-	}
-
-	std::vector<double> out(n * nl, NAN);
+	int *bandmap = panBandMap.size() > 0 ? &panBandMap[0] : NULL;
+	std::vector<double> buf;
 	CPLErr err = CE_None;
-	for (size_t j=0; j < n; j++) {
-		if ((cols[j] < 0) || (rows[j] < 0)) continue;
-		if (panBandMap.size() > 0) {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
+	size_t nb = blocks.size();
+	size_t a = 0;
+	bool cache = blockcache().enabled();
+	while (a < nb) {
+		size_t b = a + 1;
+		while ((b < nb) && (blocks[b].first == blocks[a].first)) b++;
+		if (cache) {
+			size_t j = blocks[a].second;
+			int_64 br = rows[j] / by;
+			int_64 bc = cols[j] / bx;
+			size_t bw = std::min((int_64)bx, nc - bc * bx);
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				int band = bandmap == NULL ? lyr+1 : bandmap[lyr];
+				std::shared_ptr<const std::vector<double>> blk = cached_block(poDataset, filename, band, bc, br, bx, by, err);
+				if (err != CE_None) break;
+				for (size_t k=a; k<b; k++) {
+					j = blocks[k].second;
+					out[j*nl+lyr] = (*blk)[(rows[j] - br * by) * bw + (cols[j] - bc * bx)];
+				}
+			}
+		} else if (b == (a+1)) {
+			size_t j = blocks[a].second;
+			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, bandmap, 0, 0, 0, NULL);
 		} else {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, NULL, 0, 0, 0, NULL);
-		}
-		if (err != CE_None ) { 
-			break;
+			// the part of the block that has the requested cells
+			int_64 rmin = nr, rmax = 0, cmin = nc, cmax = 0;
+			for (size_t k=a; k<b; k++) {
+				size_t j = blocks[k].second;
+				rmin = std::min(rmin, rows[j]);
+				rmax = std::max(rmax, rows[j]);
+				cmin = std::min(cmin, cols[j]);
+				cmax = std::max(cmax, cols[j]);
+			}
+			size_t w = cmax - cmin + 1;
+			size_t h = rmax - rmin + 1;
+			size_t off = w * h;
+			buf.resize(off * nl);
+			err = poDataset->RasterIO(GF_Read, cmin, rmin, w, h, &buf[0], w, h, GDT_Float64, nl, bandmap, 0, 0, 0, NULL);
+			if (err == CE_None) {
+				for (size_t k=a; k<b; k++) {
+					size_t j = blocks[k].second;
+					size_t cell = (rows[j] - rmin) * w + (cols[j] - cmin);
+					for (size_t lyr=0; lyr<nl; lyr++) {
+						out[j*nl+lyr] = buf[lyr*off + cell];
+					}
+				}
+			}
 		}
+		if (err != CE_None) break;
+		a = b;
 	}
+	return err;
+}
 
-	if (err == CE_None ) { 
-		std::vector<double> naflags(nl, NAN);
-		int hasNA;
-		for (size_t i=0; i<nl; i++) {
-			poBand = poDataset->GetRasterBand(lyrs[i]+1);
-			double naflag = poBand->GetNoDataValue(&hasNA);
-			if (hasNA)  naflags[i] = naflag;
-		}
-		NAso(out, n, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
-	}
 
-	GDALClose((GDALDatasetH) poDataset);
-	if (err != CE_None ) {
-		setError("cannot read values");
+std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
+
+	std::vector<std::vector<double>> errout;
+	std::vector<double> out = readRowColGDALFlat(src, rows, cols);
+	if (hasError()) {
 		return errout;
 	}
 
-
+	size_t nl = source[src].layers.size();
 	size_t nr = rows.size();
 	std::vector<std::vector<double>> r(nl, std::vector<double> (nr));
 	for (size_t i=0; i<nr; i++) {
@@ -1026,8 +1103,6 @@ std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::v
 }
 
 
-
-
 std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
 
 	std::vector<double> errout;
@@ -1041,6 +1116,7 @@ std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int
 	GDALRasterBand *poBand;
 	
     if( poDataset == NULL )  {
+		setError("cannot read values");
 		return errout;
 	}
 
@@ -1064,18 +1140,7 @@ std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int
 	}
 
 	std::vector<double> out(n * nl, NAN);
-	CPLErr err = CE_None;
-	for (size_t j=0; j < n; j++) {
-		if ((cols[j] < 0) || (rows[j] < 0)) continue;
-		if (panBandMap.size() > 0) {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
-		} else {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, NULL, 0, 0, 0, NULL);
-		}
-		if (err != CE_None ) { 
-			break;
-		}
-	}
+	CPLErr err = read_rowcol_blocks(poDataset, source[src].filename, panBandMap, nl, rows, cols, out);
 
 	if (err == CE_None ) { 
 		std::vector<double> naflags(nl, NAN);
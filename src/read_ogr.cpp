@@ -25,6 +25,7 @@
 #include "crs.h"
 
 #include "string_utils.h"
+#include <algorithm>
 
 std::string geomType(OGRLayer *poLayer) {
 	std::string s = "";
@@ -41,60 +42,53 @@ std::string geomType(OGRLayer *poLayer) {
 }
 
 
-SpatDataFrame readAttributes(OGRLayer *poLayer) {
-	SpatDataFrame df;
-
-    OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
-	size_t nfields = poFDefn->GetFieldCount();
-	if (nfields == 0) return df;
-
-	OGRFieldType ft;
-    poLayer->ResetReading();
-    OGRFeature *poFeature;
-	OGRFieldDefn *poFieldDefn;
-	df.resize_cols(nfields);
-	bool first = true;
-	unsigned dtype;
-    while( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-		if (first) {
-			for (size_t i = 0; i < nfields; i++ ) {
-				poFieldDefn = poFDefn->GetFieldDefn(i);
-				std::string fname = poFieldDefn->GetNameRef();
-				ft = poFieldDefn->GetType();
-				if (ft == OFTReal) {
-					dtype = 0;
-				} else if ((ft == OFTInteger) | (ft == OFTInteger64)) {
-					dtype = 1;
-				} else {
-					dtype = 2;
-				}
-				df.add_column(dtype, fname);
-			}
-			first = false;
+// add a column to df for each field of the layer that is not ignored. 
+// Returns the index of these fields
+std::vector<int> attributeColumns(OGRFeatureDefn *poFDefn, SpatDataFrame &df, const std::vector<std::string> &keep = std::vector<std::string>()) {
+	std::vector<int> fields;
+	int nfields = poFDefn->GetFieldCount();
+	for (int i = 0; i < nfields; i++ ) {
+		OGRFieldDefn *poFieldDefn = poFDefn->GetFieldDefn(i);
+		if (poFieldDefn->IsIgnored()) continue;
+		std::string fname = poFieldDefn->GetNameRef();
+		if ((!keep.empty()) && (std::find(keep.begin(), keep.end(), fname) == keep.end())) continue;
+		OGRFieldType ft = poFieldDefn->GetType();
+		unsigned dtype;
+		if (ft == OFTReal) {
+			dtype = 0;
+		} else if ((ft == OFTInteger) | (ft == OFTInteger64)) {
+			dtype = 1;
+		} else {
+			dtype = 2;
 		}
+		df.add_column(dtype, fname);
+		fields.push_back(i);
+	}
+	return fields;
+}
 
-		for (size_t i = 0; i < nfields; i++ ) {
-			poFieldDefn = poFDefn->GetFieldDefn( i );
-			unsigned j = df.iplace[i];
-			switch( poFieldDefn->GetType() ) {
-				case OFTReal:
-					df.dv[j].push_back(poFeature->GetFieldAsDouble(i));
-					break;
-				case OFTInteger:
-					df.iv[j].push_back(poFeature->GetFieldAsInteger( i ));
-					break;
-				case OFTInteger64:
-					df.iv[j].push_back(poFeature->GetFieldAsInteger64( i ));
-					break;
-	//          case OFTString:
-				default:
-					df.sv[j].push_back(poFeature->GetFieldAsString( i ));
-					break;
-			}
+// append the values of the fields of a feature to the columns of df
+void readFeatureAttributes(OGRFeature *poFeature, OGRFeatureDefn *poFDefn, const std::vector<int> &fields, SpatDataFrame &df) {
+	for (size_t j = 0; j < fields.size(); j++ ) {
+		int i = fields[j];
+		OGRFieldDefn *poFieldDefn = poFDefn->GetFieldDefn( i );
+		unsigned k = df.iplace[j];
+		switch( poFieldDefn->GetType() ) {
+			case OFTReal:
+				df.dv[k].push_back(poFeature->GetFieldAsDouble(i));
+				break;
+			case OFTInteger:
+				df.iv[k].push_back(poFeature->GetFieldAsInteger( i ));
+				break;
+			case OFTInteger64:
+				df.iv[k].push_back(poFeature->GetFieldAsInteger64( i ));
+				break;
+//          case OFTString:
+			default:
+				df.sv[k].push_back(poFeature->GetFieldAsString( i ));
+				break;
 		}
-		OGRFeature::DestroyFeature( poFeature );
 	}
-	return df;
 }
 
 
@@ -165,7 +159,7 @@ SpatGeom getPointGeom(OGRGeometry *poGeometry) {
 	double x = poPoint->getX();
 	double y = poPoint->getY();
 	SpatPart p(x, y);
-	g.addPart(p);
+	g.addPart(std::move(p));
 	return g;
 }
 
@@ -184,9 +178,9 @@ SpatGeom getMultiPointGeom(OGRGeometry *poGeometry) {
 		X[i] = poPoint->getX();
 		Y[i] = poPoint->getY();
 	}
-	SpatPart p(X, Y);
+	SpatPart p(std::move(X), std::move(Y));
 	SpatGeom g(points);
-	g.addPart(p);
+	g.addPart(std::move(p));
 	return g;
 }
 
@@ -203,9 +197,9 @@ SpatGeom getLinesGeom(OGRGeometry *poGeometry) {
 		X[i] = ogrPt.getX();
 		Y[i] = ogrPt.getY();
 	}
-	SpatPart p(X, Y);
+	SpatPart p(std::move(X), std::move(Y));
 	SpatGeom g(lines);
-	g.addPart(p);
+	g.addPart(std::move(p));
 	return g;
 }
 
@@ -225,8 +219,8 @@ SpatGeom getMultiLinesGeom(OGRGeometry *poGeometry) {
 			X[j] = ogrPt.getX();
 			Y[j] = ogrPt.getY();
 		}
-		SpatPart p(X, Y);
-		g.addPart(p);
+		SpatPart p(std::move(X), std::move(Y));
+		g.addPart(std::move(p));
 	}
 	return g;
 }
@@ -248,7 +242,7 @@ SpatGeom getPolygonsGeom(OGRGeometry *poGeometry) {
 			X[i] = ogrPt.getX();
 			Y[i] = ogrPt.getY();
 		}
-		SpatPart p(X, Y);
+		SpatPart p(std::move(X), std::move(Y));
 		unsigned nh = poGeom->getNumInteriorRings();
 		for (size_t i=0; i<nh; i++) {
 			OGRLinearRing *poHole = poGeom->getInteriorRing(i);
@@ -260,9 +254,9 @@ SpatGeom getPolygonsGeom(OGRGeometry *poGeometry) {
 				X[j] = ogrPt.getX();
 				Y[j] = ogrPt.getY();
 			}
-			p.addHole(X, Y);
+			p.addHole(std::move(X), std::move(Y));
 		}
-		g.addPart(p);
+		g.addPart(std::move(p));
 //	}
 	return g;
 }
@@ -285,7 +279,7 @@ SpatGeom getMultiPolygonsGeom(OGRGeometry *poGeometry) {
 			X[j] = ogrPt.getX();
 			Y[j] = ogrPt.getY();
 		}
-		SpatPart p(X, Y);
+		SpatPart p(std::move(X), std::move(Y));
 		unsigned nh = poPolygon->getNumInteriorRings();
 		for (size_t j=0; j<nh; j++) {
 			OGRLinearRing *poHole = poPolygon->getInteriorRing(j);
@@ -297,63 +291,31 @@ SpatGeom getMultiPolygonsGeom(OGRGeometry *poGeometry) {
 				X[k] = ogrPt.getX();
 				Y[k] = ogrPt.getY();
 			}
-			p.addHole(X, Y);
+			p.addHole(std::move(X), std::move(Y));
 		}
-		g.addPart(p);
+		g.addPart(std::move(p));
 	}
 	return g;
 }
 
 
-bool SpatVector::read_ogr(GDALDataset *poDS, std::string layer,  std::string query, std::vector<double> extent, SpatVector filter) {
-
-	std::string crs = "";
-	
-	OGRSpatialReference *poSRS = poDS->GetLayer(0)->GetSpatialRef();
-	if (poSRS) {
-		char *psz = NULL;
-		OGRErr err = poSRS->exportToWkt(&psz);
-		if (err == OGRERR_NONE) {
-			crs = psz;
-		}
-		setSRS(crs);
-		CPLFree(psz);
+// the geometry type of a layer, if it can be read
+bool readableGeomType(OGRLayer *poLayer, OGRwkbGeometryType &wkbgeom, std::string &msg) {
+	wkbgeom = wkbFlatten(poLayer->GetGeomType());
+	if ((wkbgeom == wkbPoint) || (wkbgeom == wkbMultiPoint) || 
+		(wkbgeom == wkbLineString) || (wkbgeom == wkbMultiLineString) ||
+		(wkbgeom == wkbPolygon) || (wkbgeom == wkbMultiPolygon) || (wkbgeom == wkbNone)) {
+		return true;
 	}
+	const char *geomtypechar = OGRGeometryTypeToName(wkbgeom);
+	std::string strgeomtype = geomtypechar;
+	msg = "cannot read this geometry type: "+ strgeomtype;
+	return false;			
+}
 
-	OGRLayer *poLayer;
-	
-	if (query != "") {
-		poLayer = poDS->ExecuteSQL(query.c_str(), NULL, NULL);
-		if (poLayer == NULL) {
-			setError("Query failed");
-			return false;
-		}
-	} else {
-		if (layer == "") {
-			poLayer = poDS->GetLayer(0);
-			if (poLayer == NULL) {
-				setError("dataset has no layers");
-				return false;
-			}
-		} else {
-			poLayer = poDS->GetLayerByName(layer.c_str());			
-			if (poLayer == NULL) {
-				std::string msg = layer + " is not a valid layer name";	
-			#if GDAL_VERSION_MAJOR <= 2 && GDAL_VERSION_MINOR <= 2
-				// do nothing
-			#else
-				msg += "\nChoose one of: ";
-				for ( auto&& poLayer: poDS->GetLayers() ) {
-					msg += (std::string)poLayer->GetName() + ", ";
-				}
-				msg = msg.substr(0, msg.size()-2);
-			#endif
-				setError(msg);
-				return false;
-			}
-		}
-	}
-	
+
+// restrict the features of a layer to those that intersect filter, or extent
+bool setLayerFilter(OGRLayer *poLayer, std::vector<double> extent, SpatVector filter, std::string &msg) {
 	if (filter.nrow() > 0) {
 		if (filter.type() != "polygons") {
 			filter = filter.hull("convex");
@@ -362,9 +324,9 @@ bool SpatVector::read_ogr(GDALDataset *poDS, std::string layer,  std::string que
 				filter = filter.aggregate(true);
 			}
 		}
-		GDALDataset *filterDS = filter.write_ogr("", "lyr", "Memory", true);
+		GDALDataset *filterDS = filter.write_ogr("", "lyr", "Memory", false, true);
 		if (filter.hasError()) {
-			setError(filter.getError());
+			msg = filter.getError();
 			GDALClose(filterDS);
 			return false;
 		}
@@ -380,95 +342,266 @@ bool SpatVector::read_ogr(GDALDataset *poDS, std::string layer,  std::string que
 		GDALClose(filterDS);
 	} else if (extent.size() > 0) {
 		poLayer->SetSpatialFilterRect(extent[0], extent[2], extent[1], extent[3]);
+	} else {
+		poLayer->SetSpatialFilter(NULL);
 	}
-	
-	//const char* lname = poLayer->GetName();
+	return true;
+}
+
+
+// read (at most n, if n > 0) features from the current position of a layer. 
+// Attributes and geometries are read in the same pass over the features
+size_t readFeatures(OGRLayer *poLayer, OGRwkbGeometryType wkbgeom, const std::vector<int> &fields, size_t n, bool checkZM, SpatVector &v) {
+
+	bool ispoints = (wkbgeom == wkbPoint) | (wkbgeom == wkbMultiPoint);
+	bool islines = (wkbgeom == wkbLineString) | (wkbgeom == wkbMultiLineString);
+	bool ispolys = (wkbgeom == wkbPolygon) | (wkbgeom == wkbMultiPolygon);
+	OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
 
-	df = readAttributes(poLayer);
-	OGRwkbGeometryType wkbgeom = wkbFlatten(poLayer->GetGeomType());
 	OGRFeature *poFeature;
-	
-	poLayer->ResetReading();
-	poFeature = poLayer->GetNextFeature();
-	if (poFeature != NULL) {
+	SpatGeom g;
+	size_t cnt = 0;
+	while( ((n == 0) || (cnt < n)) && ((poFeature = poLayer->GetNextFeature()) != NULL) ) {
+		cnt++;
+		readFeatureAttributes(poFeature, poFDefn, fields, v.df);
+		if (wkbgeom == wkbNone) {
+			OGRFeature::DestroyFeature( poFeature );
+			continue;
+		}
 		OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-		if (poGeometry != NULL) {
-			if (poGeometry->Is3D()) {
-				addWarning("Z coordinates ignored");
-			}
-			if (poGeometry->IsMeasured()) {
-				addWarning("M coordinates ignored");
+		if (checkZM) {
+			if (poGeometry != NULL) {
+				if (poGeometry->Is3D()) {
+					v.addWarning("Z coordinates ignored");
+				}
+				if (poGeometry->IsMeasured()) {
+					v.addWarning("M coordinates ignored");
+				}
 			}
+			checkZM = false;
 		}
-	}
-	OGRFeature::DestroyFeature( poFeature );
-	poLayer->ResetReading();
-	SpatGeom g;
-	
-	if ((wkbgeom == wkbPoint) | (wkbgeom == wkbMultiPoint)) {
-		//SpatPart p(0,0);
-		while( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-			OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-			if (poGeometry != NULL) {				
-				if ( wkbFlatten(poGeometry->getGeometryType()) == wkbPoint ) {
+		if (poGeometry != NULL) {
+			OGRwkbGeometryType gtype = wkbFlatten(poGeometry->getGeometryType());
+			if (ispoints) {
+				if (gtype == wkbPoint) {
 					g = getPointGeom(poGeometry);			
 				} else {
 					g = getMultiPointGeom(poGeometry);			
 				}
-			} else {
-				SpatPart p;
-				g = SpatGeom();
-				g.addPart(p);
-			}
-			addGeom(g);
-			OGRFeature::DestroyFeature( poFeature );
-		}
-	} else if (wkbgeom == wkbLineString || wkbgeom == wkbMultiLineString) {
-		while ( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-			OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-			if (poGeometry != NULL) {
-				if (wkbFlatten ( poGeometry ->getGeometryType() ) == wkbLineString) {
+			} else if (islines) {
+				if (gtype == wkbLineString) {
 					g = getLinesGeom(poGeometry);
 				} else {
 					g = getMultiLinesGeom(poGeometry);
 				}
 			} else {
-				SpatPart p;
-				g = SpatGeom();
-				g.addPart(p);
-			}
-			addGeom(g);
-			OGRFeature::DestroyFeature( poFeature );
-		}
-	} else if ( wkbgeom == wkbPolygon || wkbgeom == wkbMultiPolygon) {
-		while ( (poFeature = poLayer->GetNextFeature()) != NULL ) {
-			OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-			if (poGeometry != NULL) {
-				wkbgeom = wkbFlatten(poGeometry->getGeometryType());
-				if (wkbgeom == wkbPolygon) {
+				if (gtype == wkbPolygon) {
 					g = getPolygonsGeom(poGeometry);
-				} else if (wkbgeom == wkbMultiPolygon ) {
+				} else if (gtype == wkbMultiPolygon ) {
 					g = getMultiPolygonsGeom(poGeometry);
 				} 
-			} else {
-				g = SpatGeom();
 			}
-			addGeom(g);
-			OGRFeature::DestroyFeature( poFeature );
+		} else if (ispolys) {
+			g = SpatGeom();
+		} else {
+			SpatPart p;
+			g = SpatGeom();
+			g.addPart(p);
+		}
+		v.addGeom(std::move(g));
+		OGRFeature::DestroyFeature( poFeature );
+	}
+	return cnt;
+}
+
+
+std::string layerCRS(OGRLayer *poLayer) {
+	std::string crs = "";
+	OGRSpatialReference *poSRS = poLayer->GetSpatialRef();
+	if (poSRS) {
+		char *psz = NULL;
+		OGRErr err = poSRS->exportToWkt(&psz);
+		if (err == OGRERR_NONE) {
+			crs = psz;
+		}
+		CPLFree(psz);
+	}
+	return crs;
+}
+
+
+OGRLayer* getLayer(GDALDataset *poDS, std::string layer, std::string &msg) {
+	OGRLayer *poLayer;
+	if (layer == "") {
+		poLayer = poDS->GetLayer(0);
+		if (poLayer == NULL) {
+			msg = "dataset has no layers";
+		}
+	} else {
+		poLayer = poDS->GetLayerByName(layer.c_str());			
+		if (poLayer == NULL) {
+			msg = layer + " is not a valid layer name";	
+		#if GDAL_VERSION_MAJOR <= 2 && GDAL_VERSION_MINOR <= 2
+			// do nothing
+		#else
+			msg += "\nChoose one of: ";
+			for ( auto&& poLayer: poDS->GetLayers() ) {
+				msg += (std::string)poLayer->GetName() + ", ";
+			}
+			msg = msg.substr(0, msg.size()-2);
+		#endif
+		}
+	}
+	return poLayer;
+}
+
+
+bool SpatVector::read_ogr(GDALDataset *poDS, std::string layer,  std::string query, std::vector<double> extent, SpatVector filter) {
+
+	OGRLayer *poLayer;
+	std::string msg;
+	if (query != "") {
+		poLayer = poDS->ExecuteSQL(query.c_str(), NULL, NULL);
+		if (poLayer == NULL) {
+			setError("Query failed");
+			return false;
+		}
+	} else {
+		poLayer = getLayer(poDS, layer, msg);
+		if (poLayer == NULL) {
+			setError(msg);
+			return false;
+		}
+	}
+	std::string crs = layerCRS(poLayer);
+	if (crs != "") {
+		setSRS(crs);
+	}
+
+	OGRwkbGeometryType wkbgeom;
+	bool success = readableGeomType(poLayer, wkbgeom, msg) && setLayerFilter(poLayer, extent, filter, msg);
+	if (success) {
+		df = SpatDataFrame();
+		std::vector<int> fields = attributeColumns(poLayer->GetLayerDefn(), df);
+		GIntBig nfeat = poLayer->GetFeatureCount(FALSE);
+		if (nfeat > 0) {
+			df.reserve(nfeat);
+			if (wkbgeom != wkbNone) {
+				geoms.reserve(nfeat);
+			}
 		}
-	} else if (wkbgeom != wkbNone) {
-		const char *geomtypechar = OGRGeometryTypeToName(wkbgeom);
-		std::string strgeomtype = geomtypechar;
-		std::string s = "cannot read this geometry type: "+ strgeomtype;
-		setError(s);
-		return false;			
+		poLayer->ResetReading();
+		readFeatures(poLayer, wkbgeom, fields, 0, true, *this);
+	} else {
+		setError(msg);
 	}
 	
 	if (query != "") {
 		poDS->ReleaseResultSet(poLayer);
 	}
-	
- 	return true;
+ 	return success;
+}
+
+
+bool SpatVectorReader::open(std::string filename, std::string layer, std::vector<std::string> vars, std::vector<double> extent, SpatVector filter) {
+
+	close();
+	poDS = static_cast<GDALDataset*>(GDALOpenEx( filename.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL ));
+	if( poDS == NULL ) {
+		setError("Cannot open this file as a SpatVector");
+		return false;
+	}
+	std::string msg;
+	poLayer = getLayer(poDS, layer, msg);
+	if ((poLayer == NULL) || (!readableGeomType(poLayer, wkbgeom, msg))) {
+		setError(msg);
+		close();
+		return false;
+	}
+
+	// only read the requested fields
+	if (!vars.empty()) {
+		OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
+		std::vector<std::string> ignore;
+		for (size_t i=0; i<vars.size(); i++) {
+			if (poFDefn->GetFieldIndex(vars[i].c_str()) < 0) {
+				setError(vars[i] + " is not a variable in this layer");
+				close();
+				return false;
+			}
+		}
+		for (int i=0; i<poFDefn->GetFieldCount(); i++) {
+			std::string name = poFDefn->GetFieldDefn(i)->GetNameRef();
+			if (std::find(vars.begin(), vars.end(), name) == vars.end()) {
+				ignore.push_back(name);
+			}
+		}
+		std::vector<const char*> ign;
+		for (size_t i=0; i<ignore.size(); i++) {
+			ign.push_back(ignore[i].c_str());
+		}
+		ign.push_back(NULL);
+		// not all drivers can ignore fields; the other fields are then skipped while reading
+		poLayer->SetIgnoredFields(&ign[0]);
+	}
+	keep = vars;
+
+	if (!setLayerFilter(poLayer, extent, filter, msg)) {
+		setError(msg);
+		close();
+		return false;
+	}
+	crs = layerCRS(poLayer);
+	poLayer->ResetReading();
+	done = false;
+	return true;
+}
+
+
+SpatVector SpatVectorReader::next(size_t n) {
+	SpatVector out;
+	if (poLayer == NULL) {
+		out.setError("the reader is not open");
+		return out;
+	}
+	if (crs != "") {
+		out.setSRS(crs);
+	}
+	std::vector<int> fields = attributeColumns(poLayer->GetLayerDefn(), out.df, keep);
+	if (done) return out;
+	n = std::max(n, (size_t)1);
+	out.df.reserve(n);
+	size_t cnt = readFeatures(poLayer, wkbgeom, fields, n, !started, out);
+	started = true;
+	done = cnt < n;
+	msg = out.msg;
+	out.msg = SpatMessages();
+	return out;
+}
+
+
+bool SpatVectorReader::reset() {
+	if (poLayer == NULL) return false;
+	poLayer->ResetReading();
+	done = false;
+	return true;
+}
+
+
+double SpatVectorReader::nfeatures() {
+	if (poLayer == NULL) return 0;
+	return poLayer->GetFeatureCount(TRUE);
+}
+
+
+void SpatVectorReader::close() {
+	if (poDS != NULL) {
+		GDALClose(poDS);
+	}
+	poDS = NULL;
+	poLayer = NULL;
+	done = true;
+	started = false;
 }
 
 
@@ -533,7 +666,7 @@ SpatVector::SpatVector(std::vector<std::string> wkt) {
 					setError(s);
 					return;
 				}
-				addGeom(g);
+				addGeom(std::move(g));
 				OGRGeometryFactory::destroyGeometry(poGeometry);
 
 			}
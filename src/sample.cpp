@@ -21,6 +21,9 @@
 #include "recycle.h"
 #include <random>
 #include <unordered_set>
+#include <unordered_map>
+#include <queue>
+#include <numeric>
 #include "string_utils.h"
 
 
@@ -266,33 +269,53 @@ std::vector<size_t> sample_replace(size_t size, size_t N, unsigned seed){
 }
 
 
+// Walker's alias method (with Vose's construction). After building the table, 
+// each draw takes constant time, independent of N 
 std::vector<size_t> sample_replace_weights(size_t size, size_t N, std::vector<double> prob, unsigned seed){
-	
-	// normalize prob
-	double maxw = *max_element(prob.begin(), prob.end());
-	for (double& d : prob)  d /= maxw;
-	double minw = *min_element(prob.begin(), prob.end());
 
-	std::default_random_engine gen(seed);   
-	std::uniform_int_distribution<> U(0, N-1);
 	std::vector<size_t> sample;
-	sample.reserve(size);
+	double sumw = 0;
+	for (double &d : prob) {
+		if (std::isnan(d) || (d < 0)) d = 0;
+		sumw += d;
+	}
+	if (sumw <= 0) return sample;
 
-	std::uniform_real_distribution<> Uw(minw, 1);
-	size_t cnt = 0;
-	size_t cnt2 = 0;
-	size_t ssize = size * 10;
-	while (cnt < size) {
-		double w = Uw(gen);
-		double v = U(gen);
-		if (prob[v] >= w) { 
-			sample.push_back(v);
-			cnt++;
+	// scale such that the average probability is 1
+	std::vector<double> p(N);
+	for (size_t i=0; i<N; i++) p[i] = prob[i] * N / sumw;
+	std::vector<size_t> alias(N);
+	std::vector<size_t> small, large;
+	for (size_t i=0; i<N; i++) {
+		if (p[i] < 1) {
+			small.push_back(i);
 		} else {
-			cnt2++;
-			if (cnt2 > ssize) cnt = size;
+			large.push_back(i);
 		}
 	}
+	while ((!small.empty()) && (!large.empty())) {
+		size_t s = small.back();
+		small.pop_back();
+		size_t g = large.back();
+		alias[s] = g;
+		p[g] = (p[g] + p[s]) - 1;
+		if (p[g] < 1) {
+			large.pop_back();
+			small.push_back(g);
+		}
+	}
+	// what is left has (up to rounding error) probability 1
+	for (size_t i : large) p[i] = 1;
+	for (size_t i : small) p[i] = 1;
+
+	std::default_random_engine gen(seed);
+	std::uniform_int_distribution<size_t> U(0, N-1);
+	std::uniform_real_distribution<> Uw(0, 1);
+	sample.reserve(size);
+	for (size_t i=0; i<size; i++) {
+		size_t k = U(gen);
+		sample.push_back( (Uw(gen) < p[k]) ? k : alias[k] );
+	}
 	return sample;
 }
 
@@ -358,69 +381,33 @@ std::vector<size_t> sample_no_replace(size_t size, size_t N, unsigned seed){
 }
 
 
+// Efraimidis and Spirakis (2006). Each item gets a key log(u)/w, and the items with 
+// the highest keys are selected; in order of decreasing key (the order in which they 
+// would have been drawn one by one). Items with zero weight are selected last
 std::vector<size_t> sample_no_replace_weights(size_t size, size_t N, std::vector<double> prob, unsigned seed){
 	size_t one = 1;
 	size = std::max(one, std::min(size, N)); 
-	std::vector<size_t> sample;
 	std::default_random_engine gen(seed);
-	if (size == N) {
-		sample.resize(size);
-		std::iota(sample.begin(), sample.end(), 0);
-		std::shuffle(sample.begin(), sample.end(), gen);
-		return sample;
-	}
+	std::uniform_real_distribution<> U(0, 1);
+	double neginf = -std::numeric_limits<double>::infinity();
 
-	std::uniform_int_distribution<> U(0, std::numeric_limits<int>::max());
-	std::unordered_set<size_t> sampleset;
-  
-	size_t isize = size;
-	if (size > (0.8 * N)) {
-		isize = N - size;
-		for (double &d : prob) d = 1-d;
-		size_t ssize = isize * (1.1 + isize / N);
-		size_t cnt=0;
-		while (sampleset.size() < isize) {
-			seed = U(gen);
-			std::vector<size_t> s = sample_replace_weights(ssize, N, prob, seed);
-			for (size_t i=0; i<s.size(); i++) {
-				sampleset.insert(s[i]);
-			} 
-			cnt++;
-			if (cnt > 10) break;
-		}
-		std::vector<size_t> invsamp;
-		invsamp.insert(invsamp.begin(), sampleset.begin(), sampleset.end());
-		std::sort(invsamp.begin(), invsamp.end());
-		invsamp.push_back(N+1);
-		size_t j=0;
-		sample.reserve(size);
-		for (size_t i=0; i<N; i++) {
-			if (i != invsamp[j]) {
-				sample.push_back(i);
-			} else {
-				j++;
-			}
+	std::vector<double> key(N);
+	for (size_t i=0; i<N; i++) {
+		double u = U(gen);
+		if (std::isnan(prob[i]) || (prob[i] <= 0)) {
+			key[i] = neginf;
+		} else {
+			key[i] = std::log(u) / prob[i];
 		}
-		std::shuffle(sample.begin(), sample.end(), gen);
-
-	} else {
-		size_t ssize = size * (1.1 + size / N);
-		size_t cnt=0;
-		while (sampleset.size() < size) {
-			seed = U(gen);
-			std::vector<size_t> s = sample_replace_weights(ssize, N, prob, seed);
-			for (size_t i=0; i<s.size(); i++) {
-				sampleset.insert(s[i]);
-			} 
-			cnt++;
-			if (cnt > 10) break;
-		}	
-		sample.insert(sample.begin(), sampleset.begin(), sampleset.end());
-		if (sample.size() > size) {
-			sample.resize(size);
-		};
 	}
-	
+	std::vector<size_t> sample(N);
+	std::iota(sample.begin(), sample.end(), 0);
+	auto cmp = [&key](size_t a, size_t b) { return key[a] > key[b]; };
+	if (size < N) {
+		std::nth_element(sample.begin(), sample.begin()+size, sample.end(), cmp);
+		sample.resize(size);
+	}
+	std::sort(sample.begin(), sample.end(), cmp);
 	return(sample);
 }
 
@@ -473,6 +460,153 @@ std::vector<std::vector<double>> SpatRaster::sampleRandomValues(unsigned size, b
 }
 
 
+// cell in a reservoir sample
+class SampleItem {
+	public:
+		double key;
+		size_t cell;
+		std::vector<double> values;
+		bool operator>(const SampleItem &x) const { return key > x.key; }
+};
+
+typedef std::priority_queue<SampleItem, std::vector<SampleItem>, std::greater<SampleItem>> Reservoir;
+
+
+// random sample without replacement in a single pass over the values (reservoir sampling).
+// Each cell gets a random key, and the cells with the highest keys are kept. 
+// With weights, the key is log(u)/w (Efraimidis and Spirakis, 2006). 
+// If stratified, the first layer has the strata, and a sample is taken for each class;
+// if weighted, the last layer has the weights.
+// Returns the cell numbers and the values of all layers, in order of the cell numbers
+// (for each class)
+std::vector<std::vector<double>> SpatRaster::sampleStream(std::vector<double> classes, std::vector<double> sizes, bool stratified, bool weighted, bool naomit, unsigned seed, SpatOptions &opt) {
+
+	size_t nl = nlyr();
+	std::vector<std::vector<double>> out(nl+1);
+	if (!hasValues()) {
+		setError("SpatRaster has no values");
+		return out;
+	}
+	if (sizes.empty()) {
+		setError("no sample size");
+		return out;
+	}
+	if ((stratified && weighted && (nl < 2))) {
+		setError("SpatRaster should have layers for strata and weights");
+		return out;
+	}
+	if (!stratified) {
+		classes.resize(0);
+	}
+	bool anyclass = classes.empty();
+	recycle(sizes, std::max(classes.size(), (size_t)1));
+
+	std::unordered_map<double, size_t> classid;
+	for (size_t i=0; i<classes.size(); i++) {
+		classid.emplace(classes[i], i);
+	}
+	std::vector<Reservoir> res(classes.size());
+	std::vector<size_t> maxn;
+	for (size_t i=0; i<classes.size(); i++) {
+		maxn.push_back(sizes[i]);
+	}
+	if (!stratified) {
+		res.resize(1);
+		maxn.push_back(sizes[0]);
+	}
+
+	std::default_random_engine gen(seed);
+	std::uniform_real_distribution<> U(0, 1);
+
+	if (!readStart()) {
+		setError(getError());
+		return(out);
+	}
+	BlockSize bs = getBlockSize(opt);
+	size_t nc = ncol();
+	for (size_t i = 0; i < bs.n; i++) {
+		std::vector<double> v = readBlock(bs, i);
+		size_t off = bs.nrows[i] * nc;
+		size_t firstcell = bs.row[i] * nc;
+		for (size_t j=0; j<off; j++) {
+			size_t id = 0;
+			if (stratified) {
+				double c = v[j];
+				if (std::isnan(c)) continue;
+				auto it = classid.find(c);
+				if (it == classid.end()) {
+					if (!anyclass) continue;
+					id = classes.size();
+					classid.emplace(c, id);
+					classes.push_back(c);
+					res.resize(id+1);
+					maxn.push_back(sizes[0]);
+				} else {
+					id = it->second;
+				}
+			}
+			if (naomit) {
+				bool hasna = false;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					if (std::isnan(v[lyr*off+j])) {
+						hasna = true;
+						break;
+					}
+				}
+				if (hasna) continue;
+			}
+			double key;
+			if (weighted) {
+				double w = v[(nl-1)*off+j];
+				if (std::isnan(w) || (w <= 0)) continue;
+				key = std::log(U(gen)) / w;
+			} else {
+				key = U(gen);
+			}
+			Reservoir &r = res[id];
+			if (r.size() < maxn[id]) {
+				SampleItem s;
+				s.key = key;
+				s.cell = firstcell + j;
+				s.values.resize(nl);
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					s.values[lyr] = v[lyr*off+j];
+				}
+				r.push(s);
+			} else if ((maxn[id] > 0) && (key > r.top().key)) {
+				SampleItem s = r.top();
+				r.pop();
+				s.key = key;
+				s.cell = firstcell + j;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					s.values[lyr] = v[lyr*off+j];
+				}
+				r.push(s);
+			}
+		}
+	}
+	readStop();
+
+	// classes in the order in which they were given (or found)
+	for (size_t i=0; i<res.size(); i++) {
+		std::vector<SampleItem> s;
+		s.reserve(res[i].size());
+		while (!res[i].empty()) {
+			s.push_back(res[i].top());
+			res[i].pop();
+		}
+		std::sort(s.begin(), s.end(), [](const SampleItem &a, const SampleItem &b) { return a.cell < b.cell; });
+		for (size_t j=0; j<s.size(); j++) {
+			out[0].push_back(s[j].cell);
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				out[lyr+1].push_back(s[j].values[lyr]);
+			}
+		}
+	}
+	return out;
+}
+
+
 SpatRaster SpatRaster::sampleRandomRaster(unsigned size, bool replace, unsigned seed) {
 
 	unsigned nsize;
@@ -738,7 +872,7 @@ SpatVector SpatVector::sample(unsigned n, std::string method, unsigned seed) {
 		std::vector<size_t> nsamp(size());
 		for (size_t i=0; i<size(); i++) {
 			if (pa[i] > 0) {
-				SpatGeom g = getGeom(i);
+				const SpatGeom &g = getGeom(i);
 				SpatVector ve(g.extent, "");
 				ve.srs = srs;
 				double vea = ve.area()[0];
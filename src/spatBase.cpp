@@ -178,7 +178,6 @@ void SpatOptions::set_tolerance(double d) {
 	} 
 }
 
-
 bool SpatOptions::get_todisk() { return todisk; }
 void SpatOptions::set_todisk(bool b) { todisk = b; }
 
@@ -0,0 +1,103 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <numeric>
+#include "spatBase.h"
+#include "spatIndex.h"
+
+
+SpatIndex::SpatIndex(const std::vector<SpatExtent> &e, size_t node_size) {
+
+	n = e.size();
+	nodesize = std::max(node_size, (size_t)2);
+	if (n == 0) return;
+
+	std::vector<size_t> ord(n);
+	std::iota(ord.begin(), ord.end(), 0);
+	std::vector<double> cx(n), cy(n);
+	for (size_t i=0; i<n; i++) {
+		cx[i] = (e[i].xmin + e[i].xmax) / 2;
+		cy[i] = (e[i].ymin + e[i].ymax) / 2;
+	}
+
+	// sort-tile-recursive: vertical slices sorted by x, within a slice by y
+	size_t nleaves = std::ceil(n / (double) nodesize);
+	size_t nslices = std::ceil(std::sqrt((double) nleaves));
+	size_t slicesize = nslices * nodesize;
+	std::sort(ord.begin(), ord.end(), [&cx](size_t a, size_t b) { return cx[a] < cx[b]; });
+	for (size_t i=0; i<n; i+=slicesize) {
+		size_t end = std::min(i + slicesize, n);
+		std::sort(ord.begin()+i, ord.begin()+end, [&cy](size_t a, size_t b) { return cy[a] < cy[b]; });
+	}
+
+	boxes.reserve(n + 2 * nleaves);
+	ids.reserve(n + 2 * nleaves);
+	for (size_t i=0; i<n; i++) {
+		boxes.push_back(e[ord[i]]);
+		ids.push_back(ord[i]);
+	}
+	levels.push_back(n);
+
+	// pack consecutive nodes into parents until there is a single root
+	size_t start = 0;
+	size_t end = n;
+	while ((end - start) > 1) {
+		for (size_t i=start; i<end; i+=nodesize) {
+			SpatExtent b = boxes[i];
+			size_t last = std::min(i + nodesize, end);
+			for (size_t j=i+1; j<last; j++) {
+				b.unite(boxes[j]);
+			}
+			boxes.push_back(b);
+			ids.push_back(i);
+		}
+		start = end;
+		end = boxes.size();
+		levels.push_back(end);
+	}
+}
+
+
+std::vector<size_t> SpatIndex::query(const SpatExtent &e) {
+
+	std::vector<size_t> out;
+	if (n == 0) return out;
+
+	// stack of (node, level)
+	std::vector<std::pair<size_t, size_t>> stack;
+	stack.push_back({boxes.size()-1, levels.size()-1});
+	while (!stack.empty()) {
+		size_t node = stack.back().first;
+		size_t lev = stack.back().second;
+		stack.pop_back();
+		const SpatExtent &b = boxes[node];
+		if ((b.xmin > e.xmax) || (b.xmax < e.xmin) || (b.ymin > e.ymax) || (b.ymax < e.ymin)) {
+			continue;
+		}
+		if (lev == 0) {
+			out.push_back(ids[node]);
+		} else {
+			size_t first = ids[node];
+			size_t last = std::min(first + nodesize, levels[lev-1]);
+			for (size_t i=first; i<last; i++) {
+				stack.push_back({i, lev-1});
+			}
+		}
+	}
+	std::sort(out.begin(), out.end());
+	return out;
+}
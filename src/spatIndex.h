@@ -0,0 +1,42 @@
+// Copyright (c) 2018-2021  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATINDEX_GUARD
+#define SPATINDEX_GUARD
+
+// static (packed) R-tree of extents, built once with Sort-Tile-Recursive
+class SpatIndex {
+	private:
+		size_t n = 0;
+		size_t nodesize = 16;
+		// all nodes, the leaves first, then the levels above them
+		std::vector<SpatExtent> boxes;
+		// leaves: index of the input extent. other nodes: position of the first child
+		std::vector<size_t> ids;
+		// position of the last node + 1 for each level
+		std::vector<size_t> levels;
+
+	public:
+		SpatIndex() {};
+		SpatIndex(const std::vector<SpatExtent> &e, size_t node_size=16);
+
+		// indices (ascending) of the extents that intersect (or touch) e
+		std::vector<size_t> query(const SpatExtent &e);
+		size_t size() { return n; }
+};
+
+#endif
@@ -17,6 +17,7 @@
 
 #include <fstream>
 #include <numeric>
+#include <limits>
 #include "spatVector.h"
 
 #ifdef useGDAL
@@ -50,6 +51,15 @@ class SpatWindow {
 };
 
 
+// polygon edges for scanline rasterization
+// sign is used for coverage fractions: +1 or -1 such that outer rings
+// count as positive and holes as negative area, whatever their orientation
+class ScanEdge {
+	public:
+		double x1, y1, x2, y2, ymin, ymax, sign;
+};
+
+
 
 
 class SpatRasterSource {
@@ -508,7 +518,7 @@ class SpatRaster {
 		SpatExtent align(SpatExtent e, std::string snap);
 		SpatRaster rst_area(bool mask, std::string unit, bool transform, SpatOptions &opt);
 		std::vector<double> sum_area(std::string unit, bool transform, SpatOptions &opt);
-		std::vector<std::vector<double>> area_by_value(SpatOptions &opt);
+		std::vector<std::vector<double>> area_by_value(std::string unit, bool transform, SpatOptions &opt);
 
 		SpatRaster arith(SpatRaster x, std::string oper, SpatOptions &opt);
 		SpatRaster arith(double x, std::string oper, bool reverse, SpatOptions &opt);
@@ -519,6 +529,7 @@ class SpatRaster {
 
 		SpatVector as_polygons(bool trunc, bool dissolve, bool values, bool narm, SpatOptions &opt);
 		SpatVector polygonize(bool trunc, bool values, bool narm, bool aggregate, SpatOptions &opt);
+		bool polygonize_file(std::string filename, std::string lyrname, std::string driver, bool trunc, bool narm, bool overwrite, SpatOptions &opt);
 		SpatVector as_lines();
 		SpatVector as_points(bool values, bool narm, SpatOptions &opt);
 		SpatRaster atan_2(SpatRaster x, SpatOptions &opt);
@@ -540,7 +551,7 @@ class SpatRaster {
 		SpatRaster distance_vector_rasterize(SpatVector p, bool align_points, SpatOptions &opt);
 		SpatRaster distance_vector(SpatVector p, SpatOptions &opt);
 		
-		SpatRaster clumps(int directions, bool zeroAsNA, SpatOptions &opt);
+		SpatRaster clumps(int directions, bool zeroAsNA, bool addsize, SpatOptions &opt);
 
 		SpatRaster edges(bool classes, std::string type, unsigned directions, double falseval, SpatOptions &opt);
 		SpatRaster extend(SpatExtent e, SpatOptions &opt);
@@ -578,7 +589,7 @@ class SpatRaster {
 		SpatDataFrame global_weighted_mean(SpatRaster &weights, std::string fun, bool narm, SpatOptions &opt);
 
 		SpatRaster gridDistance(SpatOptions &opt);
-		SpatRaster gridCostDistance(SpatRaster cost, SpatOptions &opt);
+		SpatRaster gridCostDistance(SpatRaster cost, unsigned directions, bool links, SpatOptions &opt);
 
 		SpatRaster init(std::string value, bool plusone, SpatOptions &opt);
 		SpatRaster init(std::vector<double> values, SpatOptions &opt);
@@ -608,7 +619,12 @@ class SpatRaster {
 
 		SpatRaster modal(std::vector<double> add, std::string ties, bool narm, SpatOptions &opt);
 
-        std::vector<double> polygon_cells(SpatGeom& g);
+		// only for the rows from firstrow to lastrow (inclusive)
+        std::vector<double> polygon_cells(SpatGeom& g, size_t firstrow=0, size_t lastrow=std::numeric_limits<size_t>::max());
+		void polygon_cells_exact(SpatGeom& g, std::vector<double> &cells, std::vector<double> &weights, size_t firstrow=0, size_t lastrow=std::numeric_limits<size_t>::max());
+		// with the sorted edges of each part (computed if edges is empty) to reuse them for other rows
+		std::vector<double> polygon_cells(SpatGeom& g, std::vector<std::vector<ScanEdge>> &edges, size_t firstrow, size_t lastrow);
+		void polygon_cells_exact(SpatGeom& g, std::vector<std::vector<ScanEdge>> &edges, std::vector<double> &cells, std::vector<double> &weights, size_t firstrow, size_t lastrow);
 		SpatRaster quantile(std::vector<double> probs, bool narm, SpatOptions &opt);
 		SpatRaster stretch(std::vector<double> minv, std::vector<double> maxv, std::vector<double> minq, std::vector<double> maxq, std::vector<double> smin, std::vector<double> smax, SpatOptions &opt);
 		SpatRaster reverse(SpatOptions &opt);
@@ -618,10 +634,10 @@ class SpatRaster {
 		SpatRaster rasterizeLyr(SpatVector x, double value, double background, bool touches, bool update, SpatOptions &opt);
 
 		SpatRaster rasterize(SpatVector x, std::string field, std::vector<double> values, double background, bool touches, bool add, bool weights, bool update, bool minmax, SpatOptions &opt);
+		SpatRaster rasterizePolygons(SpatVector &x, std::vector<double> values, std::string fun, double background, bool weights, std::vector<std::string> names, std::vector<std::string> labels, SpatOptions &opt);
 		std::vector<double> rasterizeCells(SpatVector &v, bool touches);
 		std::vector<std::vector<double>> rasterizeCellsWeights(SpatVector &v, bool touches);
 
-		void rasterizeCellsWeights(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v); 
 		void rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v); 
 
 		SpatRaster replaceValues(std::vector<double> from, std::vector<double> to, long nl, SpatOptions &opt);
@@ -641,9 +657,14 @@ class SpatRaster {
 		std::vector<std::vector<double>> sampleRowColValues(size_t nr, size_t nc);
 		
 		std::vector<std::vector<double>> sampleRandomValues(unsigned size, bool replace, unsigned seed);
+		std::vector<std::vector<double>> sampleStream(std::vector<double> classes, std::vector<double> sizes, bool stratified, bool weighted, bool naomit, unsigned seed, SpatOptions &opt);
 
 		SpatRaster scale(std::vector<double> center, bool docenter, std::vector<double> scale, bool doscale, SpatOptions &opt);
 		SpatRaster terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, SpatOptions &opt);
+		SpatRaster hillshade(std::vector<double> angle, std::vector<double> direction, unsigned neighbors, bool normalize, SpatOptions &opt);
+		SpatRaster fillDepressions(bool epsilon, SpatOptions &opt);
+		SpatRaster flowAccumulation(SpatRaster weight, bool weighted, SpatOptions &opt);
+		SpatRaster watershed(std::vector<double> cells, SpatOptions &opt);
 
 		SpatRaster selRange(SpatRaster x, int z, int recycleby, SpatOptions &opt);
 
@@ -690,11 +711,13 @@ class SpatRaster {
 		//SpatRaster warp_gdal(SpatRaster x, const std::string &method, SpatOptions &opt);
 		//SpatRaster warp_gdal_crs(std::string x, const std::string &method, SpatOptions &opt);
 		SpatDataFrame zonal(SpatRaster x, std::string fun, bool narm, SpatOptions &opt);
+		SpatDataFrame zonal_vector(SpatVector p, std::string fun, bool weights, bool touches, bool narm, SpatOptions &opt);
 		SpatRaster rgb2col(size_t r,  size_t g, size_t b, SpatOptions &opt);
 		SpatRaster which(SpatOptions &opt);
 		SpatRaster is_true(SpatOptions &opt);
 
-		SpatRaster sievefilter(int threshold, int connections, SpatOptions &opt);	
+		SpatRaster sievefilter(int threshold, int directions, SpatOptions &opt);
+		SpatRaster majorityfilter(int directions, bool half, SpatOptions &opt);
 
 };
 
@@ -40,7 +40,7 @@ class SpatRasterCollection {
 				ds.erase(ds.begin()+i);
 			}
 		}
-		SpatRaster merge(SpatOptions &opt);
+		SpatRaster merge(bool vrt, SpatOptions &opt);
 		SpatRaster mosaic(std::string fun, SpatOptions &opt);
 		SpatRaster summary(std::string fun, SpatOptions &opt);
 		
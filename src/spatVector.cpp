@@ -17,6 +17,8 @@
 
 #include "spatVector.h"
 #include <numeric>
+#include <limits>
+#include <cstdint>
 
 #ifdef useGDAL
 	#include "crs.h"
@@ -26,23 +28,23 @@
 SpatHole::SpatHole() {}
 
 SpatHole::SpatHole(std::vector<double> X, std::vector<double> Y) {
-	x = X; y = Y;
-	extent.xmin = *std::min_element(X.begin(), X.end());
-	extent.xmax = *std::max_element(X.begin(), X.end());
-	extent.ymin = *std::min_element(Y.begin(), Y.end());
-	extent.ymax = *std::max_element(Y.begin(), Y.end());
+	x = std::move(X); 
+	y = std::move(Y);
+	extent.xmin = *std::min_element(x.begin(), x.end());
+	extent.xmax = *std::max_element(x.begin(), x.end());
+	extent.ymin = *std::min_element(y.begin(), y.end());
+	extent.ymax = *std::max_element(y.begin(), y.end());
 }
 
 bool SpatPart::addHole(std::vector<double> X, std::vector<double> Y) {
-	SpatHole h(X, Y);
-	holes.push_back(h);
+	holes.emplace_back(std::move(X), std::move(Y));
 	// check if inside pol?
 	return true;
 }
 
 
 bool SpatPart::addHole(SpatHole h) {
-	holes.push_back(h);
+	holes.push_back(std::move(h));
 	// check if inside pol?
 	return true;
 }
@@ -60,26 +62,27 @@ SpatPart::SpatPart(double X, double Y) {
 }
 
 SpatPart::SpatPart(std::vector<double> X, std::vector<double> Y) {
-	x = X; y = Y;
-	extent.xmin = *std::min_element(X.begin(), X.end());
-	extent.xmax = *std::max_element(X.begin(), X.end());
-	extent.ymin = *std::min_element(Y.begin(), Y.end());
-	extent.ymax = *std::max_element(Y.begin(), Y.end());
+	x = std::move(X); 
+	y = std::move(Y);
+	extent.xmin = *std::min_element(x.begin(), x.end());
+	extent.xmax = *std::max_element(x.begin(), x.end());
+	extent.ymin = *std::min_element(y.begin(), y.end());
+	extent.ymax = *std::max_element(y.begin(), y.end());
 }
 
 
 SpatGeom::SpatGeom() {}
 
 SpatGeom::SpatGeom(SpatPart p) {
-	parts.push_back(p);
 	extent = p.extent;
+	parts.push_back(std::move(p));
 }
 
 SpatGeom::SpatGeom(SpatGeomType g) {
 	gtype = g;
 }
 
-bool SpatGeom::unite(SpatGeom g) {
+bool SpatGeom::unite(const SpatGeom &g) {
 	if (parts.size() == 0) {
 		parts = g.parts;
 		extent = g.extent;
@@ -92,11 +95,12 @@ bool SpatGeom::unite(SpatGeom g) {
 
 
 bool SpatGeom::addPart(SpatPart p) {
-	parts.push_back(p);
+	parts.push_back(std::move(p));
+	const SpatPart &pp = parts.back();
 	if (parts.size() > 1) {
-		extent.unite(p.extent);
+		extent.unite(pp.extent);
 	} else {
-		extent = p.extent;
+		extent = pp.extent;
 	}
 	return true;
 }
@@ -105,7 +109,7 @@ bool SpatGeom::addPart(SpatPart p) {
 bool SpatGeom::addHole(SpatHole h) {
 	long i = parts.size()-1;
 	if (i > -1) {
-		parts[i].addHole(h);
+		parts[i].addHole(std::move(h));
 		return true;
 	} else {
 		return false;
@@ -114,28 +118,23 @@ bool SpatGeom::addHole(SpatHole h) {
 
 
 bool SpatGeom::setPart(SpatPart p, unsigned i) {
-	parts[i] = p;
 	if (parts.size() > 1) {
 		extent.unite(p.extent);
 	} else {
 		extent = p.extent;
 	}
+	parts[i] = std::move(p);
 	return true;
 }
 
 bool SpatGeom::reSetPart(SpatPart p) {
 	parts.resize(1);
-	parts[0] = p;
 	extent = p.extent;
+	parts[0] = std::move(p);
 	return true;
 }
 
 
-
-SpatPart SpatGeom::getPart(unsigned i) {
-	return parts[i];
-}
-
 SpatVector::SpatVector() {
 	extent.xmin = 0;
 	extent.xmax = 0;
@@ -273,24 +272,20 @@ std::string SpatVector::type(){
 
 
 
-SpatGeom SpatVector::getGeom(unsigned i) {
-	return geoms[i];
-}
-
 bool SpatVector::addGeom(SpatGeom p) {
-	geoms.push_back(p);
-	if (geoms.size() > 1) {
+	if (geoms.size() > 0) {
 		extent.unite(p.extent);
 	} else {
 		extent = p.extent;
 	}
+	geoms.push_back(std::move(p));
 	return true;
 }
 
 bool SpatVector::setGeom(SpatGeom p) {
 	geoms.resize(1);
-	geoms[0] = p;
 	extent = p.extent;
+	geoms[0] = std::move(p);
 	return true;
 }
 
@@ -308,10 +303,10 @@ bool SpatVector::replaceGeom(SpatGeom p, unsigned i) {
 		if ((geoms[i].extent.xmin == extent.xmin) || (geoms[i].extent.xmax == extent.xmax) ||
 			(geoms[i].extent.ymin == extent.ymin) || (geoms[i].extent.ymax == extent.ymax)) {
 
-			geoms[i] = p;
+			geoms[i] = std::move(p);
 			computeExtent();
 		} else {
-			geoms[i] = p;
+			geoms[i] = std::move(p);
 		}
 	} else {
 		return false;
@@ -323,16 +318,16 @@ bool SpatVector::replaceGeom(SpatGeom p, unsigned i) {
 unsigned SpatVector::nxy() {
 	unsigned n = 0;
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = getGeom(i);
 		if (g.size() == 0) {
 			n++; // empty
 		}
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.getPart(j);
 			n += p.x.size();
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.getHole(k);
 					n += h.x.size();
 				}
 			}
@@ -345,16 +340,16 @@ unsigned SpatVector::nxy() {
 std::vector<std::vector<double>> SpatVector::coordinates() {
 	std::vector<std::vector<double>> out(2);
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = getGeom(i);
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.getPart(j);
 			for (size_t q=0; q < p.x.size(); q++) {
 				out[0].push_back( p.x[q] );
 				out[1].push_back( p.y[q] );
 			}
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.getHole(k);
 					for (size_t q=0; q < h.x.size(); q++) {
 						out[0].push_back( h.x[q] );
 						out[1].push_back( h.y[q] );
@@ -381,7 +376,7 @@ SpatDataFrame SpatVector::getGeometryDF() {
 
 	size_t idx = 0;
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = getGeom(i);
 		if (g.size() == 0) { // empty
 			out.iv[0][idx] = i+1;
 			out.iv[1][idx] = 1;
@@ -392,7 +387,7 @@ SpatDataFrame SpatVector::getGeometryDF() {
 		}
 
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.getPart(j);
 			for (size_t q=0; q < p.x.size(); q++) {
 				out.iv[0][idx] = i+1;
 				out.iv[1][idx] = j+1;
@@ -403,7 +398,7 @@ SpatDataFrame SpatVector::getGeometryDF() {
 			}
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.getHole(k);
 					for (size_t q=0; q < h.x.size(); q++) {
 						out.iv[0][idx] = i+1;
 						out.iv[1][idx] = j+1;
@@ -425,11 +420,11 @@ std::vector<std::vector<double>> SpatVector::getGeometry() {
 
 	unsigned n = nxy();
 	std::vector<std::vector<double>> out(5);
-	for (size_t i=0; i>out.size(); i++) {
+	for (size_t i=0; i<out.size(); i++) {
 		out[i].reserve(n);
 	}
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = getGeom(i);
 		if (g.size() == 0) { // empty
 			out[0].push_back(i+1);
 			out[1].push_back(1);
@@ -439,7 +434,7 @@ std::vector<std::vector<double>> SpatVector::getGeometry() {
 		}
 
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.getPart(j);
 			for (size_t q=0; q < p.x.size(); q++) {
 				out[0].push_back(i+1);
 				out[1].push_back(j+1);
@@ -449,7 +444,7 @@ std::vector<std::vector<double>> SpatVector::getGeometry() {
 			}
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.getHole(k);
 					for (size_t q=0; q < h.x.size(); q++) {
 						out[0].push_back(i+1);
 						out[1].push_back(j+1);
@@ -476,7 +471,7 @@ std::vector<std::string> SpatVector::getGeometryWKT() {
 	std::vector<std::string> out(size());
 	std::string wkt;
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = getGeom(i);
 		size_t n = g.size();
 		if (g.gtype == points) {
 			if (n > 1) {
@@ -509,7 +504,7 @@ std::vector<std::string> SpatVector::getGeometryWKT() {
 		}		
 	
 		for (size_t j=0; j < n; j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.getPart(j);
 			if (j>0) wkt += ",";
 
 			if ((g.gtype == polygons) & (n > 1)) { 
@@ -523,7 +518,7 @@ std::vector<std::string> SpatVector::getGeometryWKT() {
 			wkt += ")";
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.getHole(k);
 					wkt += ",(" + nice_string(h.x[0]) + " " + nice_string(h.y[0]);
 					for (size_t q=1; q < h.x.size(); q++) {
 						wkt += ", " + nice_string(h.x[q]) + " " + nice_string(h.y[q]);
@@ -552,6 +547,125 @@ SpatGeomType SpatVector::getGType(std::string &type) {
 }
 
 
+// as in getGeometry, an empty geometry gets one part with a single NAN coordinate
+SpatGeomColumns SpatVector::getColumns() {
+	SpatGeomColumns out;
+	size_t ng = size();
+	if (ng == 0) return out;
+	out.gtype = geoms[0].gtype;
+	size_t np = 0, nr = 0, nc = 0;
+	for (size_t i=0; i<ng; i++) {
+		const SpatGeom &g = geoms[i];
+		if (g.parts.empty()) {
+			np++; nr++; nc++;
+		}
+		np += g.parts.size();
+		for (size_t j=0; j<g.parts.size(); j++) {
+			const SpatPart &p = g.parts[j];
+			nr += 1 + p.holes.size();
+			nc += p.x.size();
+			for (size_t k=0; k<p.holes.size(); k++) {
+				nc += p.holes[k].x.size();
+			}
+		}
+	}
+	out.geom.reserve(ng+1);
+	out.part.reserve(np+1);
+	out.ring.reserve(nr+1);
+	out.x.reserve(nc);
+	out.y.reserve(nc);
+	out.geom.push_back(0);
+	out.part.push_back(0);
+	out.ring.push_back(0);
+	for (size_t i=0; i<ng; i++) {
+		const SpatGeom &g = geoms[i];
+		if (g.parts.empty()) {
+			out.x.push_back(NAN);
+			out.y.push_back(NAN);
+			out.ring.push_back(out.x.size());
+			out.part.push_back(out.ring.size()-1);
+		}
+		for (size_t j=0; j<g.parts.size(); j++) {
+			const SpatPart &p = g.parts[j];
+			out.x.insert(out.x.end(), p.x.begin(), p.x.end());
+			out.y.insert(out.y.end(), p.y.begin(), p.y.end());
+			out.ring.push_back(out.x.size());
+			for (size_t k=0; k<p.holes.size(); k++) {
+				out.x.insert(out.x.end(), p.holes[k].x.begin(), p.holes[k].x.end());
+				out.y.insert(out.y.end(), p.holes[k].y.begin(), p.holes[k].y.end());
+				out.ring.push_back(out.x.size());
+			}
+			out.part.push_back(out.ring.size()-1);
+		}
+		out.geom.push_back(out.part.size()-1);
+	}
+	return out;
+}
+
+
+void ring_extent(const std::vector<double> &x, const std::vector<double> &y, SpatExtent &e) {
+	if (x.empty()) return;
+	e.xmin = *std::min_element(x.begin(), x.end());
+	e.xmax = *std::max_element(x.begin(), x.end());
+	e.ymin = *std::min_element(y.begin(), y.end());
+	e.ymax = *std::max_element(y.begin(), y.end());
+}
+
+
+// offsets start at zero and do not decrease (or, if strict, increase)
+bool valid_offsets(const std::vector<size_t> &v, bool strict) {
+	if (v.empty() || (v[0] != 0)) return false;
+	for (size_t i=1; i<v.size(); i++) {
+		if ((v[i] < v[i-1]) || (strict && (v[i] == v[i-1]))) return false;
+	}
+	return true;
+}
+
+
+// replaces the geometries. Each coordinate vector is allocated once, with its final size
+bool SpatVector::setColumns(const SpatGeomColumns &g) {
+	size_t ng = g.geom.empty() ? 0 : g.geom.size()-1;
+	if (ng > 0) {
+		// each part has at least one ring (the exterior)
+		if (!(valid_offsets(g.geom, false) && valid_offsets(g.part, true) && valid_offsets(g.ring, false))
+			|| (g.geom.back() >= g.part.size()) || (g.part.back() >= g.ring.size()) || (g.ring.back() > g.x.size()) || (g.x.size() != g.y.size())) {
+			setError("invalid geometry offsets");
+			return false;
+		}
+	}
+	geoms.resize(0);
+	geoms.reserve(ng);
+	for (size_t i=0; i<ng; i++) {
+		SpatGeom geom(g.gtype);
+		geom.parts.reserve(g.geom[i+1] - g.geom[i]);
+		for (size_t j=g.geom[i]; j<g.geom[i+1]; j++) {
+			SpatPart p;
+			size_t r = g.part[j];
+			p.x.assign(g.x.begin() + g.ring[r], g.x.begin() + g.ring[r+1]);
+			p.y.assign(g.y.begin() + g.ring[r], g.y.begin() + g.ring[r+1]);
+			ring_extent(p.x, p.y, p.extent);
+			size_t nh = g.part[j+1] - r - 1;
+			p.holes.resize(nh);
+			for (size_t k=0; k<nh; k++) {
+				SpatHole &h = p.holes[k];
+				h.x.assign(g.x.begin() + g.ring[r+k+1], g.x.begin() + g.ring[r+k+2]);
+				h.y.assign(g.y.begin() + g.ring[r+k+1], g.y.begin() + g.ring[r+k+2]);
+				ring_extent(h.x, h.y, h.extent);
+			}
+			if (geom.parts.empty()) {
+				geom.extent = p.extent;
+			} else {
+				geom.extent.unite(p.extent);
+			}
+			geom.parts.push_back(std::move(p));
+		}
+		geoms.push_back(std::move(geom));
+	}
+	computeExtent();
+	return true;
+}
+
+
 void SpatVector::setGeometry(std::string type, std::vector<unsigned> gid, std::vector<unsigned> part, std::vector<double> x, std::vector<double> y, std::vector<unsigned> hole) {
 
 // it is assumed that values are sorted by gid, part, hole
@@ -653,6 +767,7 @@ SpatVector SpatVector::subset_rows(std::vector<int> range) {
 		}
 	}
 
+	out.reserve(r.size());
 	for (size_t i=0; i < r.size(); i++) {
 		out.addGeom( geoms[r[i]] );
 	}
@@ -673,6 +788,7 @@ SpatVector SpatVector::subset_rows(std::vector<unsigned> range) {
 		}
 	}
 
+	out.reserve(r.size());
 	for (size_t i=0; i < r.size(); i++) {
 		out.addGeom( geoms[r[i]] );
 	}
@@ -711,6 +827,96 @@ SpatVector SpatVector::remove_rows(std::vector<unsigned> range) {
 
 
 
+// distance along a Hilbert curve of the cell (x, y) in a 2^16 by 2^16 grid
+uint64_t hilbert_index(uint32_t x, uint32_t y) {
+	uint64_t d = 0;
+	for (uint32_t s = 1u << 15; s > 0; s >>= 1) {
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += (uint64_t)s * s * ((3 * rx) ^ ry);
+		if (ry == 0) {
+			if (rx == 1) {
+				x = s-1 - (x & (s-1));
+				y = s-1 - (y & (s-1));
+			} else {
+				x = x & (s-1);
+				y = y & (s-1);
+			}
+			std::swap(x, y);
+		} else {
+			x = x & (s-1);
+			y = y & (s-1);
+		}
+	}
+	return d;
+}
+
+
+// Morton code: the bits of x and y interleaved
+uint64_t zorder_index(uint32_t x, uint32_t y) {
+	uint64_t d = 0;
+	for (uint32_t i=0; i<16; i++) {
+		d |= (uint64_t)((x >> i) & 1) << (2*i);
+		d |= (uint64_t)((y >> i) & 1) << (2*i+1);
+	}
+	return d;
+}
+
+
+std::vector<unsigned> SpatVector::spatial_order(std::string method) {
+
+	size_t n = size();
+	std::vector<unsigned> ord(n);
+	std::iota(ord.begin(), ord.end(), 0);
+	if (n < 3) return ord;
+	
+	bool hilbert = method == "hilbert";
+	if (!(hilbert || (method == "zorder"))) {
+		setError("unknown method: " + method);
+		return ord;
+	}
+
+	double xr = extent.xmax - extent.xmin;
+	double yr = extent.ymax - extent.ymin;
+	double mx = 65535 / (xr > 0 ? xr : 1);
+	double my = 65535 / (yr > 0 ? yr : 1);
+
+	// empty geometries go last
+	std::vector<uint64_t> key(n, std::numeric_limits<uint64_t>::max());
+	for (size_t i=0; i<n; i++) {
+		if (geoms[i].parts.empty()) continue;
+		const SpatExtent &e = geoms[i].extent;
+		double x = ((e.xmin + e.xmax) / 2 - extent.xmin) * mx;
+		double y = ((e.ymin + e.ymax) / 2 - extent.ymin) * my;
+		if (std::isnan(x) || std::isnan(y)) continue;
+		uint32_t ix = std::min(std::max(x, 0.0), 65535.0);
+		uint32_t iy = std::min(std::max(y, 0.0), 65535.0);
+		key[i] = hilbert ? hilbert_index(ix, iy) : zorder_index(ix, iy);
+	}
+	std::stable_sort(ord.begin(), ord.end(), [&key](unsigned a, unsigned b) { return key[a] < key[b]; });
+	return ord;
+}
+
+
+// reorder the geometries (and attributes) in place. The returned vector has the 
+// original position of each geometry; assigning geometry i to position order[i]
+// restores the original order
+std::vector<unsigned> SpatVector::sort_spatial(std::string method) {
+	std::vector<unsigned> ord = spatial_order(method);
+	if (hasError()) return ord;
+	std::vector<SpatGeom> g;
+	g.reserve(ord.size());
+	for (size_t i=0; i<ord.size(); i++) {
+		g.push_back(std::move(geoms[ord[i]]));
+	}
+	geoms = std::move(g);
+	if (df.nrow() > 0) {
+		df = df.subset_rows(ord);
+	}
+	return ord;
+}
+
+
 SpatVector SpatVector::subset_cols(std::vector<int> range) {
 	SpatVector out = *this;
 	//out.geoms = geoms;
@@ -753,6 +959,7 @@ SpatVector SpatVector::append(SpatVector x, bool ingnorecrs) {
 		}
 	}
 	out = *this;
+	out.reserve(size() + x.size());
 	for (size_t i=0; i<x.size(); i++) {
 		out.addGeom(x.getGeom(i));
 	}
@@ -814,7 +1021,7 @@ SpatVector SpatVector::as_points(bool multi, bool skiplast) {
 		SpatGeom g;
 		g.gtype = points;
 		for (size_t j=0; j<geoms[i].parts.size(); j++) {
-			SpatPart p = geoms[i].parts[j];
+			const SpatPart &p = geoms[i].parts[j];
 			if (p.size() > 0) {
 				size_t n = p.size() - skip;
 				for (size_t k=0; k<n; k++) {
@@ -822,7 +1029,7 @@ SpatVector SpatVector::as_points(bool multi, bool skiplast) {
 				}
 			}
 		}
-		v.geoms[i] = g;
+		v.geoms[i] = std::move(g);
 	}
 	if (multi) {
 		v.df = df;
@@ -862,7 +1069,7 @@ SpatVector SpatVector::as_lines() {
 			SpatPart p = v.geoms[i].parts[j];
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.getHole(k);
 					SpatPart pp(h.x, h.y);
 					v.geoms[i].addPart(pp);
 				}
@@ -35,7 +35,7 @@ class SpatHole {
 		SpatHole();
 		SpatHole(std::vector<double> X, std::vector<double> Y);
 		//methods
-		size_t size() { return x.size(); }	
+		size_t size() const { return x.size(); }	
 };
 
 class SpatPart {
@@ -50,13 +50,13 @@ class SpatPart {
 		SpatPart(double X, double Y);
 
 		//methods
-		size_t size() { return x.size(); }
+		size_t size() const { return x.size(); }
 		//holes, polygons only
 		bool addHole(std::vector<double> X, std::vector<double> Y);
 		bool addHole(SpatHole h);
-		SpatHole getHole(unsigned i) { return( holes[i] ) ; }
-		bool hasHoles() { return holes.size() > 0;}
-		unsigned nHoles() { return holes.size();}
+		const SpatHole& getHole(unsigned i) const { return( holes[i] ) ; }
+		bool hasHoles() const { return holes.size() > 0;}
+		unsigned nHoles() const { return holes.size();}
 };
 
 
@@ -70,17 +70,32 @@ class SpatGeom {
 		SpatGeom(SpatGeomType g);
 		SpatGeom(SpatPart p);
 		//methods
-		bool unite(SpatGeom g);
+		// the builders take their argument by value; pass with std::move to avoid a copy
+		bool unite(const SpatGeom &g);
 		bool addPart(SpatPart p);
 		bool addHole(SpatHole h);
 		bool setPart(SpatPart p, unsigned i);
 		bool reSetPart(SpatPart p);
-		SpatPart getPart(unsigned i);
+		const SpatPart& getPart(unsigned i) const { return parts[i]; }
+		void reserve(size_t n) { parts.reserve(n); }
 		//double area_plane();
 		//double area_lonlat(double a, double f);
 		//double length_plane();
 		//double length_lonlat(double a, double f);
-		unsigned size() { return parts.size(); };
+		unsigned size() const { return parts.size(); };
+};
+
+
+// geometries in flat coordinate arrays with offsets (as in GeoArrow). Geometry i
+// has parts geom[i] to geom[i+1]-1. Part j has rings part[j] to part[j+1]-1 (the 
+// first ring is the exterior, the others are holes). Ring k has coordinates 
+// ring[k] to ring[k+1]-1 
+class SpatGeomColumns {
+	public:
+		SpatGeomType gtype = unknown;
+		std::vector<double> x, y;
+		std::vector<size_t> geom, part, ring;
+		size_t size() { return geom.empty() ? 0 : geom.size()-1; }
 };
 
 
@@ -135,12 +150,15 @@ class SpatVector {
 			return srs.get(x);
 		}
 
-		SpatGeom getGeom(unsigned i);
+		const SpatGeom& getGeom(unsigned i) const { return geoms[i]; }
 		bool addGeom(SpatGeom p);
+		void reserve(size_t n) { geoms.reserve(n); }
 		bool setGeom(SpatGeom p);
 		bool replaceGeom(SpatGeom p, unsigned i);
 		std::vector<std::vector<double>> getGeometry();
 		SpatDataFrame getGeometryDF();
+		SpatGeomColumns getColumns();
+		bool setColumns(const SpatGeomColumns &g);
 		std::vector<std::string> getGeometryWKT();
 		void computeExtent();
 
@@ -154,13 +172,15 @@ class SpatVector {
 		SpatVector subset_rows(std::vector<int> range);
 		SpatVector subset_rows(std::vector<unsigned> range);
 		SpatVector remove_rows(std::vector<unsigned> range);
+		std::vector<unsigned> spatial_order(std::string method);
+		std::vector<unsigned> sort_spatial(std::string method);
 
 		void setGeometry(std::string type, std::vector<unsigned> gid, std::vector<unsigned> part, std::vector<double> x, std::vector<double> y, std::vector<unsigned> hole);
 		void setPointsGeometry(std::vector<double> x, std::vector<double> y);
 
-		std::vector<double> area(std::string unit, bool transform, std::vector<double> mask);
+		std::vector<double> area(std::string unit, bool transform, std::vector<double> mask, bool approx=false);
 
-		std::vector<double> length();
+		std::vector<double> length(bool approx=false);
 		std::vector<double> distance(SpatVector x, bool pairwise);
 		std::vector<double> distance(bool sequential);
 
@@ -175,10 +195,10 @@ class SpatVector {
 
 		bool read(std::string fname, std::string layer, std::string query, std::vector<double> extent, SpatVector filter);
 		
-		bool write(std::string filename, std::string lyrname, std::string driver, bool overwrite);
+		bool write(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite);
 		
 #ifdef useGDAL
-		GDALDataset* write_ogr(std::string filename, std::string lyrname, std::string driver, bool overwrite);
+		GDALDataset* write_ogr(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite);
 		GDALDataset* GDAL_ds();
 		bool read_ogr(GDALDataset *poDS, std::string layer, std::string query, std::vector<double> extent, SpatVector filter);
 		SpatVector fromDS(GDALDataset *poDS);
@@ -342,3 +362,46 @@ class SpatVectorCollection {
 		
 };
 
+
+
+// reads the features of a layer in "pages" of n features, such that 
+// layers that do not fit in memory can be processed
+class SpatVectorReader {
+
+	private:
+#ifdef useGDAL
+		GDALDataset *poDS = NULL;
+		OGRLayer *poLayer = NULL;
+		OGRwkbGeometryType wkbgeom;
+#endif
+		std::string crs;
+		// the fields to read (all if empty)
+		std::vector<std::string> keep;
+		bool done = true;
+		bool started = false;
+
+	public:
+		SpatMessages msg;
+		void setError(std::string s) { msg.setError(s); }
+		void addWarning(std::string s) { msg.addWarning(s); }
+		bool hasError() { return msg.has_error; }
+		bool hasWarning() { return msg.has_warning; }
+		std::string getWarnings() { return msg.getWarnings();}
+		std::string getError() { return msg.getError();}
+
+		SpatVectorReader() {};
+		// the reader owns the dataset, and can not be copied
+		SpatVectorReader(const SpatVectorReader&) = delete;
+		SpatVectorReader& operator=(const SpatVectorReader&) = delete;
+		~SpatVectorReader() { close(); }
+
+		// vars: the fields to read (all if empty). extent or filter: only read 
+		// the features that intersect them (this is done by the driver)
+		bool open(std::string filename, std::string layer, std::vector<std::string> vars, std::vector<double> extent, SpatVector filter);
+		// the next (at most) n features. Returns an empty SpatVector when all features have been read
+		SpatVector next(size_t n);
+		bool reset();
+		void close();
+		bool finished() { return done; }
+		double nfeatures();
+};
@@ -26,7 +26,7 @@
 std::vector<bool> SpatVector::is_valid() {
 	std::vector<bool> out;
 	out.reserve(nrow());
-	GDALDataset* src = write_ogr("", "layer", "Memory", true);
+	GDALDataset* src = write_ogr("", "layer", "Memory", false, true);
 	OGRLayer *inLayer = src->GetLayer(0);
 	inLayer->ResetReading();
 	OGRFeature *inFeature;
@@ -41,7 +41,7 @@ std::vector<bool> SpatVector::is_valid() {
 
 SpatVector SpatVector::make_valid() {
 	SpatVector out;
-	GDALDataset* src = write_ogr("", "layer", "Memory", true);
+	GDALDataset* src = write_ogr("", "layer", "Memory", false, true);
 	OGRLayer *inLayer = src->GetLayer(0);
 	inLayer->ResetReading();
 	OGRFeature *inFeature;
@@ -76,12 +76,12 @@ SpatVector SpatVector::disaggregate() {
 	}
 
 	for (size_t i=0; i<nrow(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = getGeom(i);
 		SpatDataFrame row = df.subset_rows(i);
 		for (size_t j=0; j<g.parts.size(); j++) {
 			SpatGeom gg = SpatGeom(g.parts[j]);
 			gg.gtype = g.gtype;
-			out.addGeom(gg);
+			out.addGeom(std::move(gg));
 			if (!out.df.rbind(row)) { 
 				out.setError("cannot add row");
 				return out;
@@ -112,7 +112,7 @@ SpatVector SpatVector::aggregate(std::string field, bool dissolve) {
 				g.unite( getGeom(j) );
 			}
 		}
-		out.addGeom(g);
+		out.addGeom(std::move(g));
 	}
 	if (dissolve) {
 		out = out.unaryunion();
@@ -174,7 +174,7 @@ SpatVectorCollection SpatVector::split(std::string field) {
 /*
 	} else {
 
-		GDALDataset* src = out.write_ogr("", "layer", "Memory", true);
+		GDALDataset* src = out.write_ogr("", "layer", "Memory", false, true);
 		OGRLayer *inLayer = src->GetLayer(0);
 		inLayer->ResetReading();
 		OGRFeature *inFeature;
@@ -243,11 +243,7 @@ SpatVector SpatVector::remove_holes() {
 
 	for (size_t i=0; i<n; i++) {
 		for (size_t j=0; j < out.geoms[i].size(); j++) {
-			SpatPart p = out.geoms[i].parts[j];
-			if (p.hasHoles()) {
-				p.holes.resize(0);
-				out.geoms[i].parts[j] = p;
-			}
+			out.geoms[i].parts[j].holes.clear();
 		}
 	}
 	return out;
@@ -272,17 +268,16 @@ SpatVector SpatVector::get_holes() {
 		g.gtype = polygons;	
 		bool found = false;
 		for (size_t j=0; j < geoms[i].size(); j++) {
-			SpatPart p = geoms[i].parts[j];
+			const SpatPart &p = geoms[i].parts[j];
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatPart h(p.holes[k].x, p.holes[k].y);
-					g.addPart(h);
+					g.addPart(SpatPart(p.holes[k].x, p.holes[k].y));
 				}
 				found = true;
 			}
 		}
 		if (found) {
-			out.addGeom(g);
+			out.addGeom(std::move(g));
 			atts.push_back(i);
 		}
 	}
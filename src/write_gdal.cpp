@@ -31,6 +31,7 @@
 #include "gdal_rat.h"
 
 #include "gdalio.h"
+#include "blockcache.h"
 
 
 bool setCats(GDALRasterBand *poBand, std::vector<std::string> &labels) {
@@ -197,6 +198,8 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt) {
 		setError("cannot guess file type from filename");
 		return(false);
 	}
+	// cached values of a file that is overwritten
+	blockcache().remove(filename);
 	std::string datatype = opt.get_datatype();
 	
 	bool writeRGB = (rgb && nlyr() == 3 && rgblyrs.size() == 3);
@@ -589,6 +592,7 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 
 bool SpatRaster::writeStopGDAL() {
 
+	blockcache().remove(source[0].filename);
 	GDALRasterBand *poBand;
 	source[0].hasRange.resize(nlyr());
 	std::string datatype = source[0].datatype;
@@ -177,44 +177,76 @@ bool SpatVector::ogr_geoms(std::vector<OGRGeometryH> &ogrgeoms, std::string &	me
 
 
 
-GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, std::string driver, bool overwrite) {
+// a ring or line from coordinate arrays, skipping missing coordinates
+template <typename T>
+T* ogr_curve(const std::vector<double> &x, const std::vector<double> &y) {
+	T* crv = new T;
+	size_t n = x.size();
+	size_t nok = 0;
+	for (size_t i=0; i<n; i++) {
+		nok += !std::isnan(x[i]);
+	}
+	if (nok == n) {
+		crv->setPoints(n, x.data(), y.data());
+	} else if (nok > 0) {
+		std::vector<double> X, Y;
+		X.reserve(nok);
+		Y.reserve(nok);
+		for (size_t i=0; i<n; i++) {
+			if (!std::isnan(x[i])) {
+				X.push_back(x[i]);
+				Y.push_back(y[i]);
+			}
+		}
+		crv->setPoints(nok, X.data(), Y.data());
+	}
+	return crv;
+}
 
 
+OGRGeometry* ogr_geometry(const SpatGeom &g, OGRwkbGeometryType wkb) {
+	if (wkb == wkbPoint) {
+		OGRPoint *pt = new OGRPoint;
+		if ((g.parts.size() > 0) && (g.parts[0].x.size() > 0) && (!std::isnan(g.parts[0].x[0]))) {
+			pt->setX(g.parts[0].x[0]);
+			pt->setY(g.parts[0].y[0]);
+		}
+		return pt;
+	} else if (wkb == wkbMultiLineString) {
+		OGRMultiLineString *mls = new OGRMultiLineString;
+		for (size_t j=0; j<g.parts.size(); j++) {
+			const SpatPart &p = g.parts[j];
+			mls->addGeometryDirectly(ogr_curve<OGRLineString>(p.x, p.y));
+		}
+		return mls;
+	} else {
+		OGRMultiPolygon *mp = new OGRMultiPolygon;
+		for (size_t j=0; j<g.parts.size(); j++) {
+			const SpatPart &p = g.parts[j];
+			OGRPolygon *poly = new OGRPolygon;
+			poly->addRingDirectly(ogr_curve<OGRLinearRing>(p.x, p.y));
+			for (size_t h=0; h < p.holes.size(); h++) {
+				poly->addRingDirectly(ogr_curve<OGRLinearRing>(p.holes[h].x, p.holes[h].y));
+			}
+			mp->addGeometryDirectly(poly);
+		}
+		return mp;
+	}
+}
+
+
+GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite) {
+
     GDALDataset *poDS = NULL;
 
-	if (filename != "") {
-		if (file_exists(filename) & (!overwrite)) {
-			setError("file exists. Use 'overwrite=TRUE' to overwrite it");
-			return(poDS);
-		}
-		if (nrow() == 0) {
+	if (nrow() == 0) {
+		if (filename != "") {
 			setError("no geometries to write");
 			return(poDS);		
 		}
 	}
-    GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( driver.c_str() );
-    if( poDriver == NULL )  {
-        setError( driver + " driver not available");
-        return poDS;
-    }
-    char **papszMetadata;
-    papszMetadata = poDriver->GetMetadata();
-    if (!CSLFetchBoolean( papszMetadata, GDAL_DCAP_VECTOR, FALSE)) {
-		setError(driver + " is not a vector format");
-        return poDS;
-	}
-    if (!CSLFetchBoolean( papszMetadata, GDAL_DCAP_CREATE, FALSE)) {
-		setError("cannot create a "+ driver + " dataset");
-        return poDS;
-	}
-    poDS = poDriver->Create(filename.c_str(), 0, 0, 0, GDT_Unknown, NULL );
-    if( poDS == NULL ) {
-        setError("Creation of output dataset failed" );
-        return poDS;
-    }
-
 	OGRwkbGeometryType wkb;
-	SpatGeomType geomtype = geoms[0].gtype;
+	SpatGeomType geomtype = geoms.size() > 0 ? geoms[0].gtype : polygons;
 	if (geomtype == points) {
 		wkb = wkbPoint;
 	} else if (geomtype == lines) {
@@ -226,35 +258,90 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
         return poDS;		
 	}
 
-	std::string s = srs.wkt;
-
-	OGRSpatialReference *SRS = NULL;
-	if (s != "") {
-		SRS = new OGRSpatialReference;
-		OGRErr err = SRS->SetFromUserInput(s.c_str()); 
-		if (err != OGRERR_NONE) {
-			setError("crs error");
-			delete SRS;
+	append = append && (filename != "") && file_exists(filename);
+	if (append) {
+		poDS = static_cast<GDALDataset*>(GDALOpenEx(filename.c_str(), GDAL_OF_VECTOR | GDAL_OF_UPDATE, NULL, NULL, NULL));
+		if( poDS == NULL ) {
+			setError("cannot open " + filename + " for updating");
+			return poDS;
+		}
+	} else {
+		if (filename != "") {
+			if (file_exists(filename) & (!overwrite)) {
+				setError("file exists. Use 'overwrite=TRUE' to overwrite it");
+				return(poDS);
+			}
+		}
+		GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( driver.c_str() );
+		if( poDriver == NULL )  {
+			setError( driver + " driver not available");
+			return poDS;
+		}
+		char **papszMetadata;
+		papszMetadata = poDriver->GetMetadata();
+		if (!CSLFetchBoolean( papszMetadata, GDAL_DCAP_VECTOR, FALSE)) {
+			setError(driver + " is not a vector format");
+			return poDS;
+		}
+		if (!CSLFetchBoolean( papszMetadata, GDAL_DCAP_CREATE, FALSE)) {
+			setError("cannot create a "+ driver + " dataset");
+			return poDS;
+		}
+		poDS = poDriver->Create(filename.c_str(), 0, 0, 0, GDT_Unknown, NULL );
+		if( poDS == NULL ) {
+			setError("Creation of output dataset failed" );
 			return poDS;
 		}
 	}
 
-    OGRLayer *poLayer;
-    poLayer = poDS->CreateLayer(lyrname.c_str(), SRS, wkb, NULL );
-    if( poLayer == NULL ) {
-        setError( "Layer creation failed" );
-        return poDS;
-    }
-//	if (SRS != NULL) SRS->Release();
-	if (SRS != NULL) OSRDestroySpatialReference(SRS);
-	
 	std::vector<std::string> nms = get_names();
 	std::vector<std::string> tps = df.get_datatypes();
-	OGRFieldType otype;
 	int nfields = nms.size();
 	size_t ngeoms = size();
 
+	// append to an existing layer, or create a new one
+	OGRLayer *poLayer = NULL;
+	OGRwkbGeometryType lyrwkb = wkb;
+	if (append) {
+		poLayer = poDS->GetLayerByName(lyrname.c_str());
+	}
+	if (poLayer == NULL) {
+		std::string s = srs.wkt;
+		OGRSpatialReference *SRS = NULL;
+		if (s != "") {
+			SRS = new OGRSpatialReference;
+			OGRErr err = SRS->SetFromUserInput(s.c_str()); 
+			if (err != OGRERR_NONE) {
+				setError("crs error");
+				delete SRS;
+				return poDS;
+			}
+		}
+		poLayer = poDS->CreateLayer(lyrname.c_str(), SRS, wkb, NULL );
+		if (SRS != NULL) OSRDestroySpatialReference(SRS);
+		if( poLayer == NULL ) {
+			setError( "Layer creation failed" );
+			return poDS;
+		}
+	} else {
+		// terra writes multi-types, but layers (e.g. of a Shapefile) may report the single 
+		// type, or no type. Geometries with a single part are written as the type of the layer 
+		OGRwkbGeometryType lt = wkbFlatten(poLayer->GetGeomType());
+		if (lt != wkbUnknown) {
+			if (OGR_GT_GetSingle(lt) != OGR_GT_GetSingle(wkb)) {
+				setError("cannot append " + type() + " to layer " + lyrname);
+				return poDS;
+			}
+			lyrwkb = lt;
+		}
+	}
+
+	// the position of each variable in the layer
+	std::vector<int> fidx(nfields);
 	for (int i=0; i<nfields; i++) {
+		fidx[i] = poLayer->GetLayerDefn()->GetFieldIndex(nms[i].c_str());
+		if (fidx[i] >= 0) continue;
+		OGRFieldType otype;
 		if (tps[i] == "double") {
 			otype = OFTReal;
 		} else if (tps[i] == "long") {
@@ -262,7 +349,6 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 		} else {
 			otype = OFTString;
 		}
-
 		OGRFieldDefn oField(nms[i].c_str(), otype);
 		if (otype == OFTString) {
 			oField.SetWidth(32); // needs to be computed
@@ -271,125 +357,61 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 			setError( "Field creation failed for: " + nms[i]);
 			return poDS;
 		}
+		fidx[i] = poLayer->GetLayerDefn()->GetFieldIndex(nms[i].c_str());
 	}
 
-	//unsigned r = 0;
-
+	// drivers such as GPKG are much faster when many features are
+	// committed at once. The same feature is used for all geometries
+	size_t chunk = 100000;
+	bool transaction = poDS->StartTransaction(FALSE) == OGRERR_NONE;
+	OGRFeature *poFeature = OGRFeature::CreateFeature( poLayer->GetLayerDefn() );
 	for (size_t i=0; i<ngeoms; i++) {
-	
-		OGRFeature *poFeature;
-        poFeature = OGRFeature::CreateFeature( poLayer->GetLayerDefn() );
 		for (int j=0; j<nfields; j++) {
 			if (tps[j] == "double") {
-				poFeature->SetField(j, df.getDvalue(i, j));
+				poFeature->SetField(fidx[j], df.getDvalue(i, j));
 			} else if (tps[j] == "long") {
-				poFeature->SetField(j, (GIntBig)df.getIvalue(i, j));
+				poFeature->SetField(fidx[j], (GIntBig)df.getIvalue(i, j));
 			} else {
-				poFeature->SetField(j, df.getSvalue(i, j).c_str());
+				poFeature->SetField(fidx[j], df.getSvalue(i, j).c_str());
 			}
 		}
-		//r++;
-
-// points -- also need to do multi-points
-		OGRPoint pt;
-		if (wkb == wkbPoint) {
-			SpatGeom g = getGeom(i);
-			if (!std::isnan(g.parts[0].x[0])) {
-				pt.setX( g.parts[0].x[0] );
-				pt.setY( g.parts[0].y[0] );
-			}
-			poFeature->SetGeometry( &pt );
-		
-// lines		
-		} else if (wkb == wkbMultiLineString) {
-			SpatGeom g = getGeom(i);
-			OGRMultiLineString poGeom;
-			for (size_t j=0; j<g.size(); j++) {
-				OGRLineString poLine = OGRLineString();
-				SpatPart p = g.getPart(j);
-				for (size_t k=0; k<p.size(); k++) {
-					if (!std::isnan(p.x[k])) {
-						pt.setX(p.x[k]);
-						pt.setY(p.y[k]);
-						poLine.setPoint(k, &pt);
-					}
-				}
-				if (poGeom.addGeometry(&poLine) != OGRERR_NONE ) {
-					setError("cannot add line");
-					return poDS;
-				}
-			}
-			if (poFeature->SetGeometry( &poGeom ) != OGRERR_NONE) {
-				setError("cannot set geometry");
-				return poDS;
-			}
-		
-// polygons		
-		} else if (wkb == wkbMultiPolygon) {
-			SpatGeom g = getGeom(i);
-			OGRMultiPolygon poGeom;
-			for (size_t j=0; j<g.size(); j++) {
-				OGRLinearRing poRing;
-				SpatPart p = g.getPart(j);
-				for (size_t k=0; k<p.size(); k++) {
-					if (!std::isnan(p.x[k])) {
-						pt.setX(p.x[k]);
-						pt.setY(p.y[k]);
-						poRing.setPoint(k, &pt);
-					}
-				}
-				OGRPolygon polyGeom;
-				if (polyGeom.addRing(&poRing) != OGRERR_NONE ) {
-					setError("cannot add ring");
-					return poDS;
-				}
-			
-				if (p.hasHoles()) {
-					for (size_t h=0; h < p.nHoles(); h++) {
-						SpatHole hole = p.getHole(h);
-						OGRLinearRing poHole;
-						for (size_t k=0; k<hole.size(); k++) {
-							pt.setX(hole.x[k]);
-							pt.setY(hole.y[k]);
-							poHole.setPoint(k, &pt);
-						}					
-						if (polyGeom.addRing(&poHole) != OGRERR_NONE ) {
-							setError("cannot add hole");
-							return poDS;
-						}
-					}
-				}
-				poGeom.addGeometry( &polyGeom);
-				//closeRings
-			}
-			
-			//OGRMultiPolygon* mGeom = poGeom.toMultiPolygon();	
-			if (poFeature->SetGeometry( &poGeom ) != OGRERR_NONE) {
-				setError("cannot set geometry");
-				return poDS;
-			}
-		} else {
-			setError("Only points, lines and polygons are currently supported");
-			return poDS;
+		OGRGeometry *poGeom = ogr_geometry(geoms[i], wkb);
+		if ((lyrwkb != wkb) && (geoms[i].size() == 1)) {
+			poGeom = OGRGeometryFactory::forceTo(poGeom, lyrwkb);
 		}
-	
+		poFeature->SetGeometryDirectly(poGeom);
+		poFeature->SetFID(OGRNullFID);
 		if( poLayer->CreateFeature( poFeature ) != OGRERR_NONE ) {
 			setError("Failed to create feature");
-			return poDS;
+			// do not write the features of the current transaction
+			if (transaction) {
+				poDS->RollbackTransaction();
+				transaction = false;
+			}
+			break;
         }
-
-        OGRFeature::DestroyFeature( poFeature );
+		if (transaction && ((i+1) % chunk == 0) && ((i+1) < ngeoms)) {
+			if ((poDS->CommitTransaction() != OGRERR_NONE) || (poDS->StartTransaction(FALSE) != OGRERR_NONE)) {
+				setError("cannot commit features to file");
+				transaction = false;
+				break;
+			}
+		}
     }
-    //GDALClose( poDS );
-	//return true;
+	OGRFeature::DestroyFeature( poFeature );
+	if (transaction) {
+		if (poDS->CommitTransaction() != OGRERR_NONE) {
+			setError("cannot commit features to file");
+		}
+	}
 	return poDS;
 }
 
 
 
-bool SpatVector::write(std::string filename, std::string lyrname, std::string driver, bool overwrite) {
+bool SpatVector::write(std::string filename, std::string lyrname, std::string driver, bool append, bool overwrite) {
 
-	GDALDataset *poDS = write_ogr(filename, lyrname, driver, overwrite);
+	GDALDataset *poDS = write_ogr(filename, lyrname, driver, append, overwrite);
     if (poDS != NULL) GDALClose( poDS );
 	if (hasError()) {
 		return false;
@@ -399,7 +421,7 @@ bool SpatVector::write(std::string filename, std::string lyrname, std::string dr
 }
 
 GDALDataset* SpatVector::GDAL_ds() {
-	return write_ogr("", "layer", "Memory", true);
+	return write_ogr("", "layer", "Memory", false, true);
 }
 
 